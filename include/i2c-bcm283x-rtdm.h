@@ -27,6 +27,12 @@
 #ifndef BCM283X_I2C_RTDM_H
 #define BCM283X_I2C_RTDM_H
 
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stdint.h>
+#endif
+
 /**
  * Maximum size for transmit and receive buffers.
  */
@@ -43,12 +49,15 @@
 #define BCM283X_I2C_SET_SLAVE_REGISTER_ADDRESS 1
 
 /**
- * IOCTL request for changing the I2C bus speed by baudrate.
+ * IOCTL request for changing the I2C bus speed by baudrate. The argument points to an int, the SCL rate in Hz
+ * up to BCM283X_I2C_BUS_SPEED_MAX. The rate actually used never exceeds it, see BCM283X_I2C_SET_BUS_SPEED.
  */
 #define BCM283X_I2C_SET_BAUDRATE 2
 
 /**
- * IOCTL request for changing the I2C bus speed by clock divider.
+ * IOCTL request for changing the I2C bus speed by clock divider. The argument points to an int, any divider
+ * from 2 to 65534 of the 250 MHz nominal core clock, odd values are rounded down. See bcm2835I2CClockDivider
+ * for the usual ones.
  */
 #define BCM283X_I2C_SET_CLOCK_DIVIDER 3
 
@@ -67,4 +76,631 @@
  */
 #define BCM283X_I2C_SET_FLAGS 6
 
+/**
+ * IOCTL request for running a transaction made of several segments, see bcm283x_i2c_transfer_t.
+ */
+#define BCM283X_I2C_TRANSFER 7
+
+/**
+ * Maximum number of segments in a transaction.
+ */
+#define BCM283X_I2C_SEGMENTS_MAX 16
+
+/**
+ * Segment flag: data is read from the slave. Segments without it are written to the slave.
+ */
+#define BCM283X_I2C_M_RD 0x0001
+
+/**
+ * Segment flag: data lives in the registered pool buffer named by the segment, instead of at buf.
+ */
+#define BCM283X_I2C_M_POOL 0x0002
+
+/**
+ * One segment of a transaction, opened by a START or a repeated START.
+ */
+typedef struct bcm283x_i2c_msg_s {
+	uint16_t addr; // 7-bit slave address
+	uint16_t flags; // BCM283X_I2C_M_* flags
+	uint16_t len; // Number of bytes to transfer
+	uint16_t buffer; // Pool buffer index, with BCM283X_I2C_M_POOL
+	char *buf; // Data to write, or room for the data read
+} bcm283x_i2c_msg_t;
+
+/**
+ * Argument of BCM283X_I2C_TRANSFER. The segments are run back-to-back and closed by a single STOP.
+ * The controller can't chain a repeated start after a read, so a segment following a read is opened
+ * by a STOP and a new START. The total length of the segments not using the buffer pool can't exceed
+ * BCM283X_I2C_BUFFER_SIZE_MAX.
+ * The request returns the I2C return code of the transaction.
+ */
+typedef struct bcm283x_i2c_transfer_s {
+	bcm283x_i2c_msg_t *msgs;
+	uint32_t nmsgs;
+} bcm283x_i2c_transfer_t;
+
+/**
+ * IOCTL request for setting up the submission and completion rings, see bcm283x_i2c_ring_setup_t.
+ * The entries run with the speed, budget, relative deadline and retry policy of the instance at setup,
+ * later changes don't apply to them. Their lateness isn't reported by BCM283X_I2C_GET_SCHED_STATS.
+ */
+#define BCM283X_I2C_RING_SETUP 8
+
+/**
+ * IOCTL request for waking up the ring poller, once it has set BCM283X_I2C_RING_NEED_WAKEUP.
+ */
+#define BCM283X_I2C_RING_WAKEUP 9
+
+/**
+ * mmap offset of the rings, see bcm283x_i2c_ring_t.
+ */
+#define BCM283X_I2C_MMAP_RING 0x00000000
+
+/**
+ * Maximum number of entries in each ring.
+ */
+#define BCM283X_I2C_RING_ENTRIES_MAX 256
+
+/**
+ * Maximum number of bytes written or read by a ring entry.
+ */
+#define BCM283X_I2C_RING_DATA_MAX 32
+
+/**
+ * Ring flag: the poller went idle and waits for BCM283X_I2C_RING_WAKEUP.
+ */
+#define BCM283X_I2C_RING_NEED_WAKEUP 0x0001
+
+/**
+ * Argument of BCM283X_I2C_RING_SETUP.
+ */
+typedef struct bcm283x_i2c_ring_setup_s {
+	uint32_t entries; // Number of entries of each ring, a power of 2 up to BCM283X_I2C_RING_ENTRIES_MAX
+	int32_t priority; // Priority of the poller task
+	uint32_t poll_ns; // Interval between two checks of the submission ring while active
+	uint32_t idle_ns; // Time without submission after which the poller waits for a wakeup
+} bcm283x_i2c_ring_setup_t;
+
+/**
+ * Submission entry: writes wlen bytes of data to the slave, then reads rlen bytes after a repeated start.
+ * With BCM283X_I2C_M_POOL, the bytes written are taken from the start of the pool buffer and the bytes
+ * read are stored right after them, instead of the inline data.
+ */
+typedef struct bcm283x_i2c_sqe_s {
+	uint64_t user_data; // Copied to the completion entry
+	uint16_t addr; // 7-bit slave address
+	uint16_t flags; // 0 or BCM283X_I2C_M_POOL
+	uint16_t wlen;
+	uint16_t rlen;
+	uint16_t buffer; // Pool buffer index, with BCM283X_I2C_M_POOL
+	uint16_t reserved[3];
+	uint8_t data[BCM283X_I2C_RING_DATA_MAX];
+} bcm283x_i2c_sqe_t;
+
+/**
+ * Completion entry.
+ */
+typedef struct bcm283x_i2c_cqe_s {
+	uint64_t user_data; // As submitted
+	uint64_t start; // System timer (us) when the START was issued
+	uint64_t end; // System timer (us) when the transfer was over, 0 if it didn't complete
+	int32_t status; // I2C return code, or a negative error code
+	uint16_t rlen; // Number of bytes read
+	uint16_t reserved;
+	uint8_t data[BCM283X_I2C_RING_DATA_MAX];
+} bcm283x_i2c_cqe_t;
+
+/**
+ * Header of the rings mapped at BCM283X_I2C_MMAP_RING. It is followed by the submission entries,
+ * then by the completion entries. User space produces at sq_tail and consumes at cq_head, the driver
+ * consumes at sq_head and produces at cq_tail. Indexes run freely and are masked by entries - 1.
+ * Entries must be written before the tail is advanced, with a memory barrier in between.
+ */
+typedef struct bcm283x_i2c_ring_s {
+	uint32_t sq_head;
+	uint32_t sq_tail;
+	uint32_t cq_head;
+	uint32_t cq_tail;
+	uint32_t entries;
+	uint32_t flags; // BCM283X_I2C_RING_* flags
+	uint32_t reserved[10];
+} bcm283x_i2c_ring_t;
+
+/**
+ * Submission entries of mapped rings.
+ */
+#define BCM283X_I2C_RING_SQES(ring) ((bcm283x_i2c_sqe_t *)((char *)(ring) + sizeof(bcm283x_i2c_ring_t)))
+
+/**
+ * Completion entries of mapped rings.
+ */
+#define BCM283X_I2C_RING_CQES(ring) ((bcm283x_i2c_cqe_t *)(BCM283X_I2C_RING_SQES(ring) + (ring)->entries))
+
+/**
+ * IOCTL request for registering a pool of buffers shared with user space, see bcm283x_i2c_pool_setup_t.
+ */
+#define BCM283X_I2C_POOL_SETUP 10
+
+/**
+ * mmap offset of the buffer pool. Buffer i starts at i * stride.
+ */
+#define BCM283X_I2C_MMAP_POOL 0x01000000
+
+/**
+ * Maximum number of buffers in the pool.
+ */
+#define BCM283X_I2C_POOL_BUFFERS_MAX 64
+
+/**
+ * Alignment of the pool buffers, one cache line.
+ */
+#define BCM283X_I2C_POOL_ALIGN 64
+
+/**
+ * Argument of BCM283X_I2C_POOL_SETUP.
+ */
+typedef struct bcm283x_i2c_pool_setup_s {
+	uint32_t count; // Number of buffers, up to BCM283X_I2C_POOL_BUFFERS_MAX
+	uint32_t size; // Size of each buffer, up to BCM283X_I2C_BUFFER_SIZE_MAX
+	uint32_t stride; // Returned: distance between two buffers, size rounded up to BCM283X_I2C_POOL_ALIGN
+} bcm283x_i2c_pool_setup_t;
+
+/**
+ * IOCTL request for starting the periodic sampler, see bcm283x_i2c_sampler_setup_t. Returns -EBUSY while
+ * the sampler runs. A stopped sampler can be started again, possibly with another setup: the samples it
+ * still holds are dropped.
+ */
+#define BCM283X_I2C_SAMPLER_START 11
+
+/**
+ * IOCTL request for stopping the periodic sampler. The samples not read yet remain available.
+ */
+#define BCM283X_I2C_SAMPLER_STOP 12
+
+/**
+ * IOCTL request for reading a batch of samples, see bcm283x_i2c_sampler_read_t.
+ * Returns the number of samples read, -ENODEV if the sampler was never started, or -EAGAIN while a
+ * restart replaces its buffer.
+ */
+#define BCM283X_I2C_SAMPLER_READ 13
+
+/**
+ * Maximum number of bytes read by each sample.
+ */
+#define BCM283X_I2C_SAMPLE_DATA_MAX 32
+
+/**
+ * Maximum number of samples buffered by the driver.
+ */
+#define BCM283X_I2C_SAMPLER_ENTRIES_MAX 4096
+
+/**
+ * Shortest sampling period, in nanoseconds.
+ */
+#define BCM283X_I2C_SAMPLER_PERIOD_MIN 50000
+
+/**
+ * Argument of BCM283X_I2C_SAMPLER_START. Every period, len bytes are read from register reg of the
+ * slave, after a repeated start. With a data-ready GPIO (see BCM283X_I2C_SET_DRDY), the read is run on
+ * each rising edge instead, and the period is the deadline of the read from the edge.
+ */
+typedef struct bcm283x_i2c_sampler_setup_s {
+	uint16_t addr; // 7-bit slave address
+	uint8_t reg; // Register to read from
+	uint8_t len; // Number of bytes to read, up to BCM283X_I2C_SAMPLE_DATA_MAX
+	uint32_t period_ns; // Sampling period, at least BCM283X_I2C_SAMPLER_PERIOD_MIN
+	uint32_t entries; // Number of samples buffered, a power of 2 up to BCM283X_I2C_SAMPLER_ENTRIES_MAX
+	int32_t priority; // Priority of the sampler task
+} bcm283x_i2c_sampler_setup_t;
+
+/**
+ * A sample. New samples are dropped while the buffer is full, which shows as a gap in seq.
+ */
+typedef struct bcm283x_i2c_sample_s {
+	uint64_t timestamp; // System timer (us) when the read was started, or when the data-ready edge was seen
+	uint32_t seq; // Sample number, from 0
+	int32_t status; // I2C return code, or a negative error code
+	uint8_t data[BCM283X_I2C_SAMPLE_DATA_MAX];
+} bcm283x_i2c_sample_t;
+
+/**
+ * Argument of BCM283X_I2C_SAMPLER_READ.
+ */
+typedef struct bcm283x_i2c_sampler_read_s {
+	bcm283x_i2c_sample_t *samples; // Room for count samples
+	uint32_t count; // Maximum number of samples to read
+	uint32_t min; // Number of samples to wait for, up to count, while the sampler runs
+	int64_t timeout_ns; // Longest wait, 0 waits forever, a negative value doesn't wait
+} bcm283x_i2c_sampler_read_t;
+
+/**
+ * IOCTL request for retrieving the statistics of the bus of the device, see bcm283x_i2c_stats_t.
+ */
+#define BCM283X_I2C_GET_STATS 14
+
+/**
+ * Statistics of a bus, accumulated over all the device instances since the driver was loaded.
+ */
+typedef struct bcm283x_i2c_stats_s {
+	uint64_t transfers; // Transfers run
+	uint64_t bytes; // Data bytes moved by the transfers that completed without error
+	uint32_t nack; // Transfers ended by BCM2835_I2C_REASON_ERROR_NACK
+	uint32_t clkt; // Transfers ended by BCM2835_I2C_REASON_ERROR_CLKT
+	uint32_t data; // Transfers ended by BCM2835_I2C_REASON_ERROR_DATA
+	uint32_t timeouts; // Transfers aborted because they didn't complete in time
+	uint32_t overruns; // Transfers ended by BCM2835_I2C_REASON_ERROR_TIMEOUT, their budget was spent
+	uint32_t reserved;
+} bcm283x_i2c_stats_t;
+
+/**
+ * mmap offset of the statistics page of the bus, see bcm283x_i2c_stats_page_t. It is shared by all the
+ * device instances of the bus, and can only be mapped read-only (PROT_READ, and mprotect can't add PROT_WRITE).
+ * Despite its name, it spans two 4 KB pages: map sizeof(bcm283x_i2c_stats_page_t) rounded up to the page size.
+ */
+#define BCM283X_I2C_MMAP_STATS 0x02000000
+
+/**
+ * Counters of a bus or of one of its slaves, accumulated since the driver was loaded.
+ */
+typedef struct bcm283x_i2c_counters_s {
+	uint64_t transfers; // Transfers run
+	uint64_t bytes; // Data bytes moved by the transfers that completed without error
+	uint64_t bus_ns; // Time spent on the bus, in nanoseconds
+	uint32_t nack; // Transfers ended by BCM2835_I2C_REASON_ERROR_NACK
+	uint32_t clkt; // Transfers ended by BCM2835_I2C_REASON_ERROR_CLKT
+	uint32_t data; // Short transfers, ended by BCM2835_I2C_REASON_ERROR_DATA
+	uint32_t timeouts; // Transfers aborted because they didn't complete in time
+	uint32_t overruns; // Transfers ended by BCM2835_I2C_REASON_ERROR_TIMEOUT, their budget was spent
+	uint32_t reserved;
+} bcm283x_i2c_counters_t;
+
+/**
+ * Number of slave addresses with their own counters, the 7-bit ones.
+ */
+#define BCM283X_I2C_SLAVES 128
+
+/**
+ * Statistics page mapped at BCM283X_I2C_MMAP_STATS. A transfer is counted for the slave addressed by its
+ * first segment, its bytes for the slave of each segment.
+ * The counters are updated under a sequence lock: seq is odd while an update is in progress. A reader
+ * loads seq, retries while it is odd, copies the counters it needs, issues a read barrier, and retries
+ * if seq changed in the meantime.
+ */
+typedef struct bcm283x_i2c_stats_page_s {
+	uint32_t seq; // Sequence count, odd during an update
+	uint32_t reserved;
+	bcm283x_i2c_counters_t bus; // Counters of the whole bus
+	bcm283x_i2c_counters_t slaves[BCM283X_I2C_SLAVES]; // Counters by slave address
+} bcm283x_i2c_stats_page_t;
+
+/**
+ * IOCTL request for setting the deadline of the transactions of the device instance, see bcm283x_i2c_deadline_t.
+ * While several instances contend for a bus, it is handed over by earliest deadline first. Transactions
+ * without deadline are served last, in arrival order. A transaction still waiting for the bus at its
+ * deadline fails with -ETIMEDOUT. The owner of the bus inherits the priority of the next transaction.
+ * An absolute deadline applies to the next transaction of the instance only, when threads share the
+ * instance it goes to whichever of them starts a transaction first.
+ */
+#define BCM283X_I2C_SET_DEADLINE 15
+
+/**
+ * Deadline flag: ns is an absolute time on CLOCK_MONOTONIC, for the next transaction only.
+ * Without it, ns is relative to the submission of each transaction, 0 clears it.
+ */
+#define BCM283X_I2C_DEADLINE_ABS 0x0001
+
+/**
+ * Argument of BCM283X_I2C_SET_DEADLINE.
+ */
+typedef struct bcm283x_i2c_deadline_s {
+	int64_t ns; // Deadline, in nanoseconds
+	uint32_t flags; // BCM283X_I2C_DEADLINE_* flags
+	uint32_t reserved;
+} bcm283x_i2c_deadline_t;
+
+/**
+ * IOCTL request for retrieving the lateness of the transactions of the device instance that had a deadline,
+ * see bcm283x_i2c_sched_stats_t. Lateness is the completion time minus the deadline, negative when early.
+ */
+#define BCM283X_I2C_GET_SCHED_STATS 16
+
+/**
+ * Lateness of the transactions of a device instance. The predicted completion is taken when the transaction
+ * gets the bus, from its size and the clock divider.
+ */
+typedef struct bcm283x_i2c_sched_stats_s {
+	uint64_t transactions; // Transactions run with a deadline
+	uint64_t misses; // Transactions completed after their deadline
+	uint64_t predicted_misses; // Transactions predicted to complete after their deadline
+	int64_t last_predicted_lateness_ns; // Predicted lateness of the last transaction
+	int64_t last_lateness_ns; // Lateness of the last transaction
+	int64_t max_lateness_ns; // Largest lateness
+} bcm283x_i2c_sched_stats_t;
+
+/**
+ * IOCTL request for setting the wall-clock budget of each transfer of the device instance, in microseconds,
+ * counted once the transfer has the bus. The argument points to an int, 0 for none.
+ * A transfer that exceeds it is aborted and returns BCM2835_I2C_REASON_ERROR_TIMEOUT (0x08).
+ */
+#define BCM283X_I2C_SET_TRANSFER_BUDGET 17
+
+/**
+ * IOCTL request for setting the clock stretch timeout of the bus (BSC CLKT), in SCL cycles, up to 65535.
+ * The argument points to an int, 0 disables the timeout. A slave stretching the clock for longer ends
+ * the transfer with BCM2835_I2C_REASON_ERROR_CLKT. Shared by all the instances of the device.
+ */
+#define BCM283X_I2C_SET_CLOCK_STRETCH_TIMEOUT 18
+
+/**
+ * IOCTL request for getting the SCL rate the transactions of the device instance run at, in Hz. It follows
+ * from the rate set with BCM283X_I2C_SET_BAUDRATE or BCM283X_I2C_SET_CLOCK_DIVIDER and the current rate of
+ * the core clock, which may differ from 250 MHz and change at run time. The argument points to an int.
+ */
+#define BCM283X_I2C_GET_BUS_RATE 19
+
+/**
+ * Highest SCL rate accepted, in Hz (Fast-mode Plus).
+ */
+#define BCM283X_I2C_BUS_SPEED_MAX 1000000
+
+/**
+ * IOCTL request for setting the I2C bus speed of the device instance from a target SCL rate. The argument points
+ * to an int holding the target in Hz, up to BCM283X_I2C_BUS_SPEED_MAX, and receives the rate achieved. The driver
+ * picks the smallest even clock divider that doesn't exceed the target, and data delays (BSC DEL) matching it.
+ */
+#define BCM283X_I2C_SET_BUS_SPEED 20
+
+/**
+ * IOCTL request for running an SMBus command on the slave of the device instance, in a single transaction,
+ * see bcm283x_i2c_smbus_t. The request returns the I2C return code of the transaction, or -EPROTO if a block
+ * read returns an invalid length.
+ */
+#define BCM283X_I2C_SMBUS 21
+
+/**
+ * Direction of an SMBus command.
+ */
+#define BCM283X_I2C_SMBUS_WRITE 0
+#define BCM283X_I2C_SMBUS_READ 1
+
+/**
+ * SMBus protocols. Process calls always write, then read the reply.
+ */
+#define BCM283X_I2C_SMBUS_BYTE 1 // Send byte (the command) or receive byte
+#define BCM283X_I2C_SMBUS_BYTE_DATA 2
+#define BCM283X_I2C_SMBUS_WORD_DATA 3
+#define BCM283X_I2C_SMBUS_PROC_CALL 4
+#define BCM283X_I2C_SMBUS_BLOCK_DATA 5
+#define BCM283X_I2C_SMBUS_BLOCK_PROC_CALL 7
+
+/**
+ * Maximum length of an SMBus block.
+ */
+#define BCM283X_I2C_SMBUS_BLOCK_MAX 32
+
+/**
+ * Argument of BCM283X_I2C_SMBUS. The data is updated with the reply of reads and process calls.
+ * The controller needs the length of a read up front, so a block read clocks in the largest block
+ * and the bytes past the length announced by the slave are dropped.
+ */
+typedef struct bcm283x_i2c_smbus_s {
+	uint8_t read_write; // BCM283X_I2C_SMBUS_READ or BCM283X_I2C_SMBUS_WRITE
+	uint8_t command; // Command code
+	uint16_t protocol; // BCM283X_I2C_SMBUS_* protocol
+	uint8_t data[BCM283X_I2C_SMBUS_BLOCK_MAX + 2]; // Byte, little-endian word, or block length followed by the block
+} bcm283x_i2c_smbus_t;
+
+/**
+ * IOCTL request for checking the data of the device instance with a CRC-8, see bcm283x_i2c_crc_t. It applies to
+ * read_rt() and write_rt(), and BCM283X_I2C_CRC_PEC also to BCM283X_I2C_SMBUS. Reads return the data checked
+ * and stripped of its CRC, or -EBADMSG if a CRC doesn't match. Writes have the CRC inserted.
+ */
+#define BCM283X_I2C_SET_CRC 22
+
+/**
+ * CRC modes.
+ */
+#define BCM283X_I2C_CRC_NONE 0 // No CRC
+#define BCM283X_I2C_CRC_PEC 1 // SMBus PEC: CRC-8 (x^8 + x^2 + x + 1) over the address bytes and the data, after the data
+#define BCM283X_I2C_CRC_WORD 2 // CRC-8 after each word of data, with the polynomial and initial value given
+
+/**
+ * Maximum length of a word checked by BCM283X_I2C_CRC_WORD.
+ */
+#define BCM283X_I2C_CRC_WORD_MAX 32
+
+/**
+ * Argument of BCM283X_I2C_SET_CRC. With BCM283X_I2C_CRC_WORD, the length of the data must be a multiple of word_len.
+ */
+typedef struct bcm283x_i2c_crc_s {
+	uint8_t mode; // BCM283X_I2C_CRC_* mode
+	uint8_t poly; // Polynomial without its x^8 term, MSB first (e.g. 0x31 for x^8 + x^5 + x^4 + 1), BCM283X_I2C_CRC_WORD only
+	uint8_t init; // Initial value, BCM283X_I2C_CRC_WORD only
+	uint8_t word_len; // Bytes covered by each CRC, BCM283X_I2C_CRC_WORD only
+} bcm283x_i2c_crc_t;
+
+/**
+ * IOCTL request for setting up the register cache of the slave of the device instance, see bcm283x_i2c_regmap_t.
+ * The cache belongs to the slave address set at that time, and starts empty. No range disables it.
+ */
+#define BCM283X_I2C_REGMAP_SETUP 23
+
+/**
+ * IOCTL request for reading consecutive registers through the cache, see bcm283x_i2c_reg_access_t. They are
+ * served from memory if all are cached, otherwise read from the slave after a repeated start, filling the cache.
+ * The request returns the I2C return code of the transaction, if any.
+ */
+#define BCM283X_I2C_REGMAP_READ 24
+
+/**
+ * IOCTL request for writing consecutive registers through the cache, see bcm283x_i2c_reg_access_t. If all are
+ * write-back, only the cache is updated, otherwise the registers are written to the slave and to the cache.
+ * The request returns the I2C return code of the transaction if any, or -EPERM if a register is read-only.
+ */
+#define BCM283X_I2C_REGMAP_WRITE 25
+
+/**
+ * IOCTL request for writing the registers changed in the cache to the slave. Runs of consecutive registers are
+ * written in one segment each, and the segments are chained with repeated starts in as few transactions as possible.
+ * The request returns the I2C return code of the last transaction.
+ */
+#define BCM283X_I2C_REGMAP_SYNC 26
+
+/**
+ * IOCTL request for emptying the register cache, changes not written yet are lost.
+ */
+#define BCM283X_I2C_REGMAP_DROP 27
+
+/**
+ * IOCTL request for triggering the sampler of the device instance with the data-ready line of the slave, from the
+ * next BCM283X_I2C_SAMPLER_START. The argument points to an int, the BCM GPIO number of the line, or -1 to
+ * sample periodically. Returns -EBUSY while the sampler runs: stop it, change the line, then start it again.
+ */
+#define BCM283X_I2C_SET_DRDY 28
+
+/**
+ * IOCTL request for reading from the device like read_rt() does, along with the timestamps of the transaction,
+ * see bcm283x_i2c_read_ts_t. Returns the number of bytes read.
+ */
+#define BCM283X_I2C_READ_TS 29
+
+/**
+ * Timestamps of a transaction, taken by the driver on the System Timer (1 MHz) and converted to rtdm_clock_read().
+ * The conversion follows the drift between both clocks, measured over the transactions timestamped.
+ */
+typedef struct bcm283x_i2c_timestamps_s {
+	uint64_t start_us; // When the START was issued
+	uint64_t first_us; // At the first FIFO event, at most a FIFO (16 bytes) after the first byte
+	uint64_t done_us; // When the transfer was over, 0 if it didn't complete
+	int64_t start_ns; // Same as start_us, on rtdm_clock_read()
+	int64_t first_ns;
+	int64_t done_ns;
+} bcm283x_i2c_timestamps_t;
+
+/**
+ * Argument of BCM283X_I2C_READ_TS.
+ */
+typedef struct bcm283x_i2c_read_ts_s {
+	char *buf; // Room for size bytes
+	uint32_t size; // Number of bytes to read
+	uint32_t reserved;
+	bcm283x_i2c_timestamps_t ts; // Timestamps of the read
+} bcm283x_i2c_read_ts_t;
+
+/**
+ * IOCTL request for retrieving the latency histograms of the bus of the device, see bcm283x_i2c_histograms_t.
+ */
+#define BCM283X_I2C_GET_HISTOGRAMS 30
+
+/**
+ * IOCTL request for clearing the latency histograms of the bus of the device. Transfers in progress may be
+ * counted before or after the reset.
+ */
+#define BCM283X_I2C_RESET_HISTOGRAMS 31
+
+/**
+ * Operation types of the histograms.
+ */
+#define BCM283X_I2C_OP_READ 0 // read_rt() and BCM283X_I2C_READ_TS
+#define BCM283X_I2C_OP_WRITE 1 // write_rt()
+#define BCM283X_I2C_OP_IOCTL 2 // Other IOCTL requests running transactions
+#define BCM283X_I2C_OP_RING 3 // Submission ring entries
+#define BCM283X_I2C_OP_SAMPLER 4 // Sampler reads
+#define BCM283X_I2C_OPS 5
+
+/**
+ * Measurements of the histograms.
+ */
+#define BCM283X_I2C_HIST_TOTAL 0 // Whole system call, or whole transaction for the ring and the sampler
+#define BCM283X_I2C_HIST_WAIT 1 // Waiting for the bus
+#define BCM283X_I2C_HIST_BUS 2 // Transfer on the bus
+#define BCM283X_I2C_HISTS 3
+
+/**
+ * Number of buckets of a histogram. Bucket 0 counts durations under 1 ns, bucket k from 2^(k-1) included
+ * to 2^k ns excluded, and the last one everything from 2^30 ns (about 1 s).
+ */
+#define BCM283X_I2C_HIST_BUCKETS 32
+
+/**
+ * Argument of BCM283X_I2C_GET_HISTOGRAMS, counts indexed by operation type, measurement and bucket.
+ */
+typedef struct bcm283x_i2c_histograms_s {
+	uint32_t counts[BCM283X_I2C_OPS][BCM283X_I2C_HISTS][BCM283X_I2C_HIST_BUCKETS];
+} bcm283x_i2c_histograms_t;
+
+/**
+ * Maximum number of register ranges.
+ */
+#define BCM283X_I2C_REGMAP_RANGES_MAX 32
+
+/**
+ * Register types. Registers out of any range are volatile.
+ */
+#define BCM283X_I2C_REG_VOLATILE 0 // Never cached
+#define BCM283X_I2C_REG_READ_ONLY 1 // Read once, can't be written
+#define BCM283X_I2C_REG_WRITE_THROUGH 2 // Cached, writes go to the slave right away
+#define BCM283X_I2C_REG_WRITE_BACK 3 // Cached, writes go to the slave on BCM283X_I2C_REGMAP_SYNC
+
+/**
+ * A range of registers of the same type.
+ */
+typedef struct bcm283x_i2c_reg_range_s {
+	uint8_t first; // First register of the range
+	uint8_t last; // Last register of the range, included
+	uint16_t type; // BCM283X_I2C_REG_* type
+} bcm283x_i2c_reg_range_t;
+
+/**
+ * Argument of BCM283X_I2C_REGMAP_SETUP. The slave has 256 8-bit registers, and auto-increments the register
+ * address on consecutive accesses. Later ranges override earlier ones.
+ */
+typedef struct bcm283x_i2c_regmap_s {
+	bcm283x_i2c_reg_range_t *ranges;
+	uint32_t nranges;
+} bcm283x_i2c_regmap_t;
+
+/**
+ * Argument of BCM283X_I2C_REGMAP_READ and BCM283X_I2C_REGMAP_WRITE.
+ */
+typedef struct bcm283x_i2c_reg_access_s {
+	uint8_t reg; // First register
+	uint8_t reserved;
+	uint16_t len; // Number of registers, reg + len can't exceed 256
+	char *buf; // Values of the registers
+} bcm283x_i2c_reg_access_t;
+
+/**
+ * IOCTL request for setting the retry policy of the transactions of the device instance, see bcm283x_i2c_retry_t.
+ * Transactions ending with one of the selected I2C return codes are run again by the driver, the bus being
+ * released while backing off. The sampler doesn't retry, its next period does.
+ */
+#define BCM283X_I2C_SET_RETRY 32
+
+/**
+ * Maximum number of retries of a transaction.
+ */
+#define BCM283X_I2C_RETRY_MAX 16
+
+/**
+ * Maximum backoff before a retry, in microseconds.
+ */
+#define BCM283X_I2C_RETRY_BACKOFF_MAX_US 1000000
+
+/**
+ * Retry flag: the backoff doubles after each retry, up to BCM283X_I2C_RETRY_BACKOFF_MAX_US.
+ */
+#define BCM283X_I2C_RETRY_EXPONENTIAL 0x0001
+
+/**
+ * Argument of BCM283X_I2C_SET_RETRY. A retry whose backoff would end after the deadline of the transaction
+ * isn't attempted.
+ */
+typedef struct bcm283x_i2c_retry_s {
+	uint32_t count; // Retries after the first attempt, 0 disables them
+	uint32_t backoff_us; // Backoff before the first retry, 0 retries right away
+	uint16_t reasons; // Mask of the bcm2835I2CReasonCodes to retry, e.g. BCM2835_I2C_REASON_ERROR_NACK
+	uint16_t flags; // BCM283X_I2C_RETRY_* flags
+} bcm283x_i2c_retry_t;
+
 #endif /* BCM283X_I2C_RTDM_H */
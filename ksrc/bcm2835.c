@@ -18,6 +18,7 @@
 #include <linux/printk.h>
 #include <linux/byteorder/generic.h>
 #include <linux/of.h>
+#include <linux/math64.h>
 
 #define BCK2835_LIBRARY_BUILD
 #include "bcm2835.h"
@@ -25,12 +26,6 @@
 /* Return value of `mmap' in case of an error, as a replacement of the one provided by mman.h  */
 #define MAP_FAILED	((void *) -1)
 
-/* Uncommenting this define compiles alternative I2C code for the version 1 RPi
-// The P1 header I2C pins are connected to SDA0 and SCL0 on V1.
-// By default I2C code is generated for the V2 RPi which has SDA1 and SCL1 connected.
-*/
-/* #define I2C_V1*/
-
 /* Physical address and size of the peripherals block
 // May be overridden on RPi2
 */
@@ -66,10 +61,6 @@ struct dt_soc_ranges{
 */
 static uint8_t debug = 0;
 
-/* I2C The time needed to transmit one byte. In microseconds.
- */
-static int i2c_byte_wait_us = 0;
-
 /*
 // Low level register access functions
 */
@@ -94,7 +85,7 @@ uint32_t* bcm2835_regbase(uint8_t regbase)
 	case BCM2835_REGBASE_BSC0:
 	    return (uint32_t *)bcm2835_bsc0;
 	case BCM2835_REGBASE_BSC1:
-	    return (uint32_t *)bcm2835_st;
+	    return (uint32_t *)bcm2835_bsc1;
     }
     return (uint32_t *)MAP_FAILED;
 }
@@ -718,101 +709,209 @@ void bcm2835_spi_setChipSelectPolarity(uint8_t cs, uint8_t active)
     bcm2835_peri_set_bits(paddr, active << shift, 1 << shift);
 }
 
-void bcm2835_i2c_begin(void)
+/* Caches the clock divider of a controller and the time it takes to transmit one byte */
+static void bcm2835_i2c_update_timing(bcm2835I2C* i2c, uint16_t divider)
+{
+    i2c->divider = divider;
+    /* Calculate time for transmitting one byte
+    // 9 = Clocks per byte : 8 bits + ACK
+    // A divider of 0 stands for 32768, the core clock is not always a whole number of MHz
+    */
+    i2c->byte_time_ns = (uint32_t)div_u64((uint64_t)(divider ? divider : 32768) * 9 * 1000000000ULL,
+					  i2c->core_clk_hz);
+    i2c->byte_wait_us = (i2c->byte_time_ns + 999) / 1000;
+}
+
+void bcm2835_i2c_begin(bcm2835I2C* i2c, uint8_t bus)
 {
+    volatile uint32_t* paddr;
     uint16_t cdiv;
 
-#ifdef I2C_V1
-    volatile uint32_t* paddr = bcm2835_bsc0 + BCM2835_BSC_DIV/4;
-    /* Set the I2C/BSC0 pins to the Alt 0 function to enable I2C access on them */
-    bcm2835_gpio_fsel(RPI_GPIO_P1_03, BCM2835_GPIO_FSEL_ALT0); /* SDA */
-    bcm2835_gpio_fsel(RPI_GPIO_P1_05, BCM2835_GPIO_FSEL_ALT0); /* SCL */
-#else
-    volatile uint32_t* paddr = bcm2835_bsc1 + BCM2835_BSC_DIV/4;
-    /* Set the I2C/BSC1 pins to the Alt 0 function to enable I2C access on them */
-    bcm2835_gpio_fsel(RPI_V2_GPIO_P1_03, BCM2835_GPIO_FSEL_ALT0); /* SDA */
-    bcm2835_gpio_fsel(RPI_V2_GPIO_P1_05, BCM2835_GPIO_FSEL_ALT0); /* SCL */
-#endif    
+    if (bus == BCM2835_I2C_BSC0)
+    {
+	i2c->base = bcm2835_bsc0;
+	i2c->sda  = RPI_GPIO_P1_03;
+	i2c->scl  = RPI_GPIO_P1_05;
+    }
+    else
+    {
+	i2c->base = bcm2835_bsc1;
+	i2c->sda  = RPI_V2_GPIO_P1_03;
+	i2c->scl  = RPI_V2_GPIO_P1_05;
+    }
+    paddr = i2c->base + BCM2835_BSC_DIV/4;
+
+    /* Set the I2C/BSC pins to the Alt 0 function to enable I2C access on them */
+    bcm2835_gpio_fsel(i2c->sda, BCM2835_GPIO_FSEL_ALT0); /* SDA */
+    bcm2835_gpio_fsel(i2c->scl, BCM2835_GPIO_FSEL_ALT0); /* SCL */
 
     /* Read the clock divider register */
+    i2c->core_clk_hz = BCM2835_CORE_CLK_HZ;
     cdiv = bcm2835_peri_read(paddr);
-    /* Calculate time for transmitting one byte
-    // 1000000 = micros seconds in a second
-    // 9 = Clocks per byte : 8 bits + ACK
-    */
-    //i2c_byte_wait_us = ((float)cdiv / BCM2835_CORE_CLK_HZ) * 1000000 * 9;
+    bcm2835_i2c_update_timing(i2c, cdiv);
+
+    /* Initialise the other shadow registers from the hardware */
+    i2c->addr = bcm2835_peri_read(i2c->base + BCM2835_BSC_A/4) & 0x7F;
+    i2c->del  = bcm2835_peri_read(i2c->base + BCM2835_BSC_DEL/4);
+    i2c->clkt = bcm2835_peri_read(i2c->base + BCM2835_BSC_CLKT/4) & 0xFFFF;
 }
 
-void bcm2835_i2c_end(void)
+void bcm2835_i2c_end(bcm2835I2C* i2c)
 {
-#ifdef I2C_V1
-    /* Set all the I2C/BSC0 pins back to input */
-    bcm2835_gpio_fsel(RPI_GPIO_P1_03, BCM2835_GPIO_FSEL_INPT); /* SDA */
-    bcm2835_gpio_fsel(RPI_GPIO_P1_05, BCM2835_GPIO_FSEL_INPT); /* SCL */
-#else
-    /* Set all the I2C/BSC1 pins back to input */
-    bcm2835_gpio_fsel(RPI_V2_GPIO_P1_03, BCM2835_GPIO_FSEL_INPT); /* SDA */
-    bcm2835_gpio_fsel(RPI_V2_GPIO_P1_05, BCM2835_GPIO_FSEL_INPT); /* SCL */
-#endif
+    /* Set all the I2C/BSC pins back to input */
+    bcm2835_gpio_fsel(i2c->sda, BCM2835_GPIO_FSEL_INPT); /* SDA */
+    bcm2835_gpio_fsel(i2c->scl, BCM2835_GPIO_FSEL_INPT); /* SCL */
 }
 
-void bcm2835_i2c_setSlaveAddress(uint8_t addr)
+void bcm2835_i2c_setSlaveAddress(bcm2835I2C* i2c, uint8_t addr)
 {
     /* Set I2C Device Address */
-#ifdef I2C_V1
-    volatile uint32_t* paddr = bcm2835_bsc0 + BCM2835_BSC_A/4;
-#else	
-    volatile uint32_t* paddr = bcm2835_bsc1 + BCM2835_BSC_A/4;
-#endif
+    volatile uint32_t* paddr = i2c->base + BCM2835_BSC_A/4;
+    if (i2c->addr == addr)
+	return;
     bcm2835_peri_write(paddr, addr);
+    i2c->addr = addr;
 }
 
 /* defaults to 0x5dc, should result in a 166.666 kHz I2C clock frequency.
 // The divisor must be a power of 2. Odd numbers
 // rounded down.
 */
-void bcm2835_i2c_setClockDivider(uint16_t divider)
+void bcm2835_i2c_setClockDivider(bcm2835I2C* i2c, uint16_t divider)
 {
-#ifdef I2C_V1
-    volatile uint32_t* paddr = bcm2835_bsc0 + BCM2835_BSC_DIV/4;
-#else
-    volatile uint32_t* paddr = bcm2835_bsc1 + BCM2835_BSC_DIV/4;
-#endif    
+    volatile uint32_t* paddr = i2c->base + BCM2835_BSC_DIV/4;
+    if (i2c->divider == divider)
+	return;
     bcm2835_peri_write(paddr, divider);
-    /* Calculate time for transmitting one byte
-    // 1000000 = micros seconds in a second
-    // 9 = Clocks per byte : 8 bits + ACK
-    */
-    //i2c_byte_wait_us = ((float)divider / BCM2835_CORE_CLK_HZ) * 1000000 * 9;
+    bcm2835_i2c_update_timing(i2c, divider);
 }
 
 /* set I2C clock divider by means of a baudrate number */
-void bcm2835_i2c_set_baudrate(uint32_t baudrate)
+void bcm2835_i2c_set_baudrate(bcm2835I2C* i2c, uint32_t baudrate)
 {
 	uint32_t divider;
 	/* use 0xFFFE mask to limit a max value and round down any odd number */
-	divider = (BCM2835_CORE_CLK_HZ / baudrate) & 0xFFFE;
-	bcm2835_i2c_setClockDivider( (uint16_t)divider );
+	divider = (i2c->core_clk_hz / baudrate) & 0xFFFE;
+	bcm2835_i2c_setClockDivider(i2c, (uint16_t)divider );
+}
+
+void bcm2835_i2c_setCoreClock(bcm2835I2C* i2c, uint32_t core_clk_hz)
+{
+    if (i2c->core_clk_hz == core_clk_hz || core_clk_hz == 0)
+	return;
+    i2c->core_clk_hz = core_clk_hz;
+    bcm2835_i2c_update_timing(i2c, i2c->divider);
+}
+
+void bcm2835_i2c_setDataDelay(bcm2835I2C* i2c, uint16_t fedl, uint16_t redl)
+{
+    volatile uint32_t* paddr = i2c->base + BCM2835_BSC_DEL/4;
+    uint32_t del = ((uint32_t)fedl << 16) | redl;
+    if (i2c->del == del)
+	return;
+    bcm2835_peri_write(paddr, del);
+    i2c->del = del;
+}
+
+void bcm2835_i2c_setClockStretchTimeout(bcm2835I2C* i2c, uint16_t timeout)
+{
+    volatile uint32_t* paddr = i2c->base + BCM2835_BSC_CLKT/4;
+    if (i2c->clkt == timeout)
+	return;
+    bcm2835_peri_write(paddr, timeout);
+    i2c->clkt = timeout;
+}
+
+/* Whether a transfer of the given number of bytes, address bytes included, started at start
+// on the System Timer has run for more than twice its bus time. Like in the driver engine, it is
+// then taken as lost, so a wedged bus can't hang the caller.
+// Reading the System Timer takes barriers, so it is only read every BCM2835_I2C_POLLS_PER_CHECK
+// calls, counted in polls.
+*/
+static int bcm2835_i2c_expired(bcm2835I2C* i2c, uint64_t start, uint32_t bytes, uint32_t* polls)
+{
+    if (++*polls % BCM2835_I2C_POLLS_PER_CHECK)
+	return 0;
+    return bcm2835_st_read() - start > 2 * (uint64_t)i2c->byte_wait_us * bytes + BCM2835_I2C_TIMEOUT_SLACK_US;
+}
+
+/* Stops the transfer in progress, and clears the FIFO and the status */
+static void bcm2835_i2c_abort(bcm2835I2C* i2c)
+{
+    bcm2835_peri_write(i2c->base + BCM2835_BSC_C/4, BCM2835_BSC_C_CLEAR_1);
+    bcm2835_peri_write(i2c->base + BCM2835_BSC_S/4, BCM2835_BSC_S_CLKT | BCM2835_BSC_S_ERR | BCM2835_BSC_S_DONE);
+}
+
+uint32_t bcm2835_i2c_fill_fifo(bcm2835I2C* i2c, const char* buf, uint32_t len)
+{
+    volatile uint32_t* fifo    = i2c->base + BCM2835_BSC_FIFO/4;
+    volatile uint32_t* status  = i2c->base + BCM2835_BSC_S/4;
+    uint32_t s = bcm2835_peri_read_nb(status);
+    uint32_t n = 0;
+
+    if (s & BCM2835_BSC_S_TXE)
+    {
+	/* Room for a whole FIFO, no need to check again */
+	while (n < len && n < BCM2835_BSC_FIFO_SIZE)
+	    bcm2835_peri_write_nb(fifo, buf[n++]);
+    }
+    else
+    {
+	while (n < len && (s & BCM2835_BSC_S_TXD))
+	{
+	    bcm2835_peri_write_nb(fifo, buf[n++]);
+	    s = bcm2835_peri_read_nb(status);
+	}
+    }
+
+    /* One barrier for the whole batch */
+    if (n)
+	__sync_synchronize();
+    return n;
+}
+
+uint32_t bcm2835_i2c_drain_fifo(bcm2835I2C* i2c, char* buf, uint32_t len)
+{
+    volatile uint32_t* fifo    = i2c->base + BCM2835_BSC_FIFO/4;
+    volatile uint32_t* status  = i2c->base + BCM2835_BSC_S/4;
+    uint32_t s = bcm2835_peri_read_nb(status);
+    uint32_t n = 0;
+
+    if (s & BCM2835_BSC_S_RXF)
+    {
+	/* A whole FIFO to read, no need to check again */
+	while (n < len && n < BCM2835_BSC_FIFO_SIZE)
+	    buf[n++] = bcm2835_peri_read_nb(fifo);
+    }
+    else
+    {
+	while (n < len && (s & BCM2835_BSC_S_RXD))
+	{
+	    buf[n++] = bcm2835_peri_read_nb(fifo);
+	    s = bcm2835_peri_read_nb(status);
+	}
+    }
+
+    /* One barrier for the whole batch */
+    if (n)
+	__sync_synchronize();
+    return n;
 }
 
 /* Writes an number of bytes to I2C */
-uint8_t bcm2835_i2c_write(const char * buf, uint32_t len)
-{
-#ifdef I2C_V1
-    volatile uint32_t* dlen    = bcm2835_bsc0 + BCM2835_BSC_DLEN/4;
-    volatile uint32_t* fifo    = bcm2835_bsc0 + BCM2835_BSC_FIFO/4;
-    volatile uint32_t* status  = bcm2835_bsc0 + BCM2835_BSC_S/4;
-    volatile uint32_t* control = bcm2835_bsc0 + BCM2835_BSC_C/4;
-#else
-    volatile uint32_t* dlen    = bcm2835_bsc1 + BCM2835_BSC_DLEN/4;
-    volatile uint32_t* fifo    = bcm2835_bsc1 + BCM2835_BSC_FIFO/4;
-    volatile uint32_t* status  = bcm2835_bsc1 + BCM2835_BSC_S/4;
-    volatile uint32_t* control = bcm2835_bsc1 + BCM2835_BSC_C/4;
-#endif    
+uint8_t bcm2835_i2c_write(bcm2835I2C* i2c, const char * buf, uint32_t len)
+{
+    volatile uint32_t* dlen    = i2c->base + BCM2835_BSC_DLEN/4;
+    volatile uint32_t* fifo    = i2c->base + BCM2835_BSC_FIFO/4;
+    volatile uint32_t* status  = i2c->base + BCM2835_BSC_S/4;
+    volatile uint32_t* control = i2c->base + BCM2835_BSC_C/4;
 
     uint32_t remaining = len;
     uint32_t i = 0;
+    uint32_t n;
     uint8_t reason = BCM2835_I2C_REASON_OK;
+    uint64_t start = bcm2835_st_read();
+    uint32_t polls = 0;
 
     /* Clear FIFO */
     bcm2835_peri_set_bits(control, BCM2835_BSC_C_CLEAR_1 , BCM2835_BSC_C_CLEAR_1 );
@@ -831,17 +930,30 @@ uint8_t bcm2835_i2c_write(const char * buf, uint32_t len)
     /* Enable device and start transfer */
     bcm2835_peri_write(control, BCM2835_BSC_C_I2CEN | BCM2835_BSC_C_ST);
     
-    /* Transfer is over when BCM2835_BSC_S_DONE */
-    while(!(bcm2835_peri_read(status) & BCM2835_BSC_S_DONE ))
+    /* Transfer is over when BCM2835_BSC_S_DONE. Only the BSC is accessed meanwhile but for the
+    // occasional System Timer read of the budget, which brings its own barriers, so polling needs
+    // no barrier, the FIFO is refilled in batches
+    */
+    while(!(bcm2835_peri_read_nb(status) & BCM2835_BSC_S_DONE ))
     {
-        while ( remaining && (bcm2835_peri_read(status) & BCM2835_BSC_S_TXD ))
+        if (bcm2835_i2c_expired(i2c, start, len + 1, &polls))
+        {
+	    reason = BCM2835_I2C_REASON_ERROR_TIMEOUT;
+	    break;
+        }
+        if (remaining)
     	{
 	    /* Write to FIFO */
-	    bcm2835_peri_write(fifo, buf[i]);
-	    i++;
-	    remaining--;
+	    n = bcm2835_i2c_fill_fifo(i2c, buf + i, remaining);
+	    i += n;
+	    remaining -= n;
     	}
     }
+    if (reason == BCM2835_I2C_REASON_ERROR_TIMEOUT)
+    {
+	bcm2835_i2c_abort(i2c);
+	return reason;
+    }
 
     /* Received a NACK */
     if (bcm2835_peri_read(status) & BCM2835_BSC_S_ERR)
@@ -867,23 +979,18 @@ uint8_t bcm2835_i2c_write(const char * buf, uint32_t len)
 }
 
 /* Read an number of bytes from I2C */
-uint8_t bcm2835_i2c_read(char* buf, uint32_t len)
-{
-#ifdef I2C_V1
-    volatile uint32_t* dlen    = bcm2835_bsc0 + BCM2835_BSC_DLEN/4;
-    volatile uint32_t* fifo    = bcm2835_bsc0 + BCM2835_BSC_FIFO/4;
-    volatile uint32_t* status  = bcm2835_bsc0 + BCM2835_BSC_S/4;
-    volatile uint32_t* control = bcm2835_bsc0 + BCM2835_BSC_C/4;
-#else
-    volatile uint32_t* dlen    = bcm2835_bsc1 + BCM2835_BSC_DLEN/4;
-    volatile uint32_t* fifo    = bcm2835_bsc1 + BCM2835_BSC_FIFO/4;
-    volatile uint32_t* status  = bcm2835_bsc1 + BCM2835_BSC_S/4;
-    volatile uint32_t* control = bcm2835_bsc1 + BCM2835_BSC_C/4;
-#endif    
+uint8_t bcm2835_i2c_read(bcm2835I2C* i2c, char* buf, uint32_t len)
+{
+    volatile uint32_t* dlen    = i2c->base + BCM2835_BSC_DLEN/4;
+    volatile uint32_t* status  = i2c->base + BCM2835_BSC_S/4;
+    volatile uint32_t* control = i2c->base + BCM2835_BSC_C/4;
 
     uint32_t remaining = len;
     uint32_t i = 0;
+    uint32_t n;
     uint8_t reason = BCM2835_I2C_REASON_OK;
+    uint64_t start = bcm2835_st_read();
+    uint32_t polls = 0;
 
     /* Clear FIFO */
     bcm2835_peri_set_bits(control, BCM2835_BSC_C_CLEAR_1 , BCM2835_BSC_C_CLEAR_1 );
@@ -897,23 +1004,27 @@ uint8_t bcm2835_i2c_read(char* buf, uint32_t len)
     /* wait for transfer to complete */
     while (!(bcm2835_peri_read_nb(status) & BCM2835_BSC_S_DONE))
     {
+        if (bcm2835_i2c_expired(i2c, start, len + 1, &polls))
+        {
+	    reason = BCM2835_I2C_REASON_ERROR_TIMEOUT;
+	    break;
+        }
         /* we must empty the FIFO as it is populated and not use any delay */
-        while (bcm2835_peri_read_nb(status) & BCM2835_BSC_S_RXD)
-    	{
-	    /* Read from FIFO, no barrier */
-	    buf[i] = bcm2835_peri_read_nb(fifo);
-	    i++;
-	    remaining--;
-    	}
+        n = bcm2835_i2c_drain_fifo(i2c, buf + i, remaining);
+        i += n;
+        remaining -= n;
+    }
+    if (reason == BCM2835_I2C_REASON_ERROR_TIMEOUT)
+    {
+	bcm2835_i2c_abort(i2c);
+	return reason;
     }
     
     /* transfer has finished - grab any remaining stuff in FIFO */
-    while (remaining && (bcm2835_peri_read_nb(status) & BCM2835_BSC_S_RXD))
+    while (remaining && (n = bcm2835_i2c_drain_fifo(i2c, buf + i, remaining)))
     {
-        /* Read from FIFO, no barrier */
-        buf[i] = bcm2835_peri_read_nb(fifo);
-        i++;
-        remaining--;
+        i += n;
+        remaining -= n;
     }
     
     /* Received a NACK */
@@ -942,22 +1053,18 @@ uint8_t bcm2835_i2c_read(char* buf, uint32_t len)
 /* Read an number of bytes from I2C sending a repeated start after writing
 // the required register. Only works if your device supports this mode
 */
-uint8_t bcm2835_i2c_read_register_rs(char* regaddr, char* buf, uint32_t len)
+uint8_t bcm2835_i2c_read_register_rs(bcm2835I2C* i2c, char* regaddr, char* buf, uint32_t len)
 {   
-#ifdef I2C_V1
-    volatile uint32_t* dlen    = bcm2835_bsc0 + BCM2835_BSC_DLEN/4;
-    volatile uint32_t* fifo    = bcm2835_bsc0 + BCM2835_BSC_FIFO/4;
-    volatile uint32_t* status  = bcm2835_bsc0 + BCM2835_BSC_S/4;
-    volatile uint32_t* control = bcm2835_bsc0 + BCM2835_BSC_C/4;
-#else
-    volatile uint32_t* dlen    = bcm2835_bsc1 + BCM2835_BSC_DLEN/4;
-    volatile uint32_t* fifo    = bcm2835_bsc1 + BCM2835_BSC_FIFO/4;
-    volatile uint32_t* status  = bcm2835_bsc1 + BCM2835_BSC_S/4;
-    volatile uint32_t* control = bcm2835_bsc1 + BCM2835_BSC_C/4;
-#endif    
+    volatile uint32_t* dlen    = i2c->base + BCM2835_BSC_DLEN/4;
+    volatile uint32_t* fifo    = i2c->base + BCM2835_BSC_FIFO/4;
+    volatile uint32_t* status  = i2c->base + BCM2835_BSC_S/4;
+    volatile uint32_t* control = i2c->base + BCM2835_BSC_C/4;
 	uint32_t remaining = len;
     uint32_t i = 0;
+    uint32_t n;
     uint8_t reason = BCM2835_I2C_REASON_OK;
+    uint64_t start = bcm2835_st_read();
+    uint32_t polls = 0;
     
     /* Clear FIFO */
     bcm2835_peri_set_bits(control, BCM2835_BSC_C_CLEAR_1 , BCM2835_BSC_C_CLEAR_1 );
@@ -973,38 +1080,52 @@ uint8_t bcm2835_i2c_read_register_rs(char* regaddr, char* buf, uint32_t len)
     /* poll for transfer has started */
     while ( !( bcm2835_peri_read(status) & BCM2835_BSC_S_TA ) )
     {
+        if (bcm2835_i2c_expired(i2c, start, 2, &polls))
+        {
+	    reason = BCM2835_I2C_REASON_ERROR_TIMEOUT;
+	    break;
+        }
         /* Linux may cause us to miss entire transfer stage */
         if(bcm2835_peri_read(status) & BCM2835_BSC_S_DONE)
             break;
     }
+    if (reason == BCM2835_I2C_REASON_ERROR_TIMEOUT)
+    {
+	bcm2835_i2c_abort(i2c);
+	return reason;
+    }
     
     /* Send a repeated start with read bit set in address */
     bcm2835_peri_write(dlen, len);
     bcm2835_peri_write(control, BCM2835_BSC_C_I2CEN | BCM2835_BSC_C_ST  | BCM2835_BSC_C_READ );
     
     /* Wait for write to complete and first byte back. */
-    bcm2835_delayMicroseconds(i2c_byte_wait_us * 3);
+    bcm2835_delayMicroseconds(i2c->byte_wait_us * 3);
     
     /* wait for transfer to complete */
-    while (!(bcm2835_peri_read(status) & BCM2835_BSC_S_DONE))
+    while (!(bcm2835_peri_read_nb(status) & BCM2835_BSC_S_DONE))
     {
+        if (bcm2835_i2c_expired(i2c, start, len + 3, &polls))
+        {
+	    reason = BCM2835_I2C_REASON_ERROR_TIMEOUT;
+	    break;
+        }
         /* we must empty the FIFO as it is populated and not use any delay */
-        while (remaining && bcm2835_peri_read(status) & BCM2835_BSC_S_RXD)
-    	{
-	    /* Read from FIFO */
-	    buf[i] = bcm2835_peri_read(fifo);
-	    i++;
-	    remaining--;
-    	}
+        n = bcm2835_i2c_drain_fifo(i2c, buf + i, remaining);
+        i += n;
+        remaining -= n;
+    }
+    if (reason == BCM2835_I2C_REASON_ERROR_TIMEOUT)
+    {
+	bcm2835_i2c_abort(i2c);
+	return reason;
     }
     
     /* transfer has finished - grab any remaining stuff in FIFO */
-    while (remaining && (bcm2835_peri_read(status) & BCM2835_BSC_S_RXD))
+    while (remaining && (n = bcm2835_i2c_drain_fifo(i2c, buf + i, remaining)))
     {
-        /* Read from FIFO */
-        buf[i] = bcm2835_peri_read(fifo);
-        i++;
-        remaining--;
+        i += n;
+        remaining -= n;
     }
     
     /* Received a NACK */
@@ -1033,23 +1154,19 @@ uint8_t bcm2835_i2c_read_register_rs(char* regaddr, char* buf, uint32_t len)
 /* Sending an arbitrary number of bytes before issuing a repeated start 
 // (with no prior stop) and reading a response. Some devices require this behavior.
 */
-uint8_t bcm2835_i2c_write_read_rs(char* cmds, uint32_t cmds_len, char* buf, uint32_t buf_len)
+uint8_t bcm2835_i2c_write_read_rs(bcm2835I2C* i2c, char* cmds, uint32_t cmds_len, char* buf, uint32_t buf_len)
 {   
-#ifdef I2C_V1
-    volatile uint32_t* dlen    = bcm2835_bsc0 + BCM2835_BSC_DLEN/4;
-    volatile uint32_t* fifo    = bcm2835_bsc0 + BCM2835_BSC_FIFO/4;
-    volatile uint32_t* status  = bcm2835_bsc0 + BCM2835_BSC_S/4;
-    volatile uint32_t* control = bcm2835_bsc0 + BCM2835_BSC_C/4;
-#else
-    volatile uint32_t* dlen    = bcm2835_bsc1 + BCM2835_BSC_DLEN/4;
-    volatile uint32_t* fifo    = bcm2835_bsc1 + BCM2835_BSC_FIFO/4;
-    volatile uint32_t* status  = bcm2835_bsc1 + BCM2835_BSC_S/4;
-    volatile uint32_t* control = bcm2835_bsc1 + BCM2835_BSC_C/4;
-#endif    
+    volatile uint32_t* dlen    = i2c->base + BCM2835_BSC_DLEN/4;
+    volatile uint32_t* fifo    = i2c->base + BCM2835_BSC_FIFO/4;
+    volatile uint32_t* status  = i2c->base + BCM2835_BSC_S/4;
+    volatile uint32_t* control = i2c->base + BCM2835_BSC_C/4;
 
     uint32_t remaining = cmds_len;
     uint32_t i = 0;
+    uint32_t n;
     uint8_t reason = BCM2835_I2C_REASON_OK;
+    uint64_t start = bcm2835_st_read();
+    uint32_t polls = 0;
     
     /* Clear FIFO */
     bcm2835_peri_set_bits(control, BCM2835_BSC_C_CLEAR_1 , BCM2835_BSC_C_CLEAR_1 );
@@ -1074,10 +1191,20 @@ uint8_t bcm2835_i2c_write_read_rs(char* cmds, uint32_t cmds_len, char* buf, uint
     /* poll for transfer has started (way to do repeated start, from BCM2835 datasheet) */
     while ( !( bcm2835_peri_read(status) & BCM2835_BSC_S_TA ) )
     {
+        if (bcm2835_i2c_expired(i2c, start, cmds_len + 1, &polls))
+        {
+	    reason = BCM2835_I2C_REASON_ERROR_TIMEOUT;
+	    break;
+        }
         /* Linux may cause us to miss entire transfer stage */
         if(bcm2835_peri_read_nb(status) & BCM2835_BSC_S_DONE)
             break;
     }
+    if (reason == BCM2835_I2C_REASON_ERROR_TIMEOUT)
+    {
+	bcm2835_i2c_abort(i2c);
+	return reason;
+    }
     
     remaining = buf_len;
     i = 0;
@@ -1087,28 +1214,32 @@ uint8_t bcm2835_i2c_write_read_rs(char* cmds, uint32_t cmds_len, char* buf, uint
     bcm2835_peri_write(control, BCM2835_BSC_C_I2CEN | BCM2835_BSC_C_ST  | BCM2835_BSC_C_READ );
     
     /* Wait for write to complete and first byte back. */
-    bcm2835_delayMicroseconds(i2c_byte_wait_us * (cmds_len + 1));
+    bcm2835_delayMicroseconds(i2c->byte_wait_us * (cmds_len + 1));
     
     /* wait for transfer to complete */
     while (!(bcm2835_peri_read_nb(status) & BCM2835_BSC_S_DONE))
     {
+        if (bcm2835_i2c_expired(i2c, start, cmds_len + buf_len + 2, &polls))
+        {
+	    reason = BCM2835_I2C_REASON_ERROR_TIMEOUT;
+	    break;
+        }
         /* we must empty the FIFO as it is populated and not use any delay */
-        while (remaining && bcm2835_peri_read(status) & BCM2835_BSC_S_RXD)
-    	{
-	    /* Read from FIFO, no barrier */
-	    buf[i] = bcm2835_peri_read_nb(fifo);
-	    i++;
-	    remaining--;
-    	}
+        n = bcm2835_i2c_drain_fifo(i2c, buf + i, remaining);
+        i += n;
+        remaining -= n;
+    }
+    if (reason == BCM2835_I2C_REASON_ERROR_TIMEOUT)
+    {
+	bcm2835_i2c_abort(i2c);
+	return reason;
     }
     
     /* transfer has finished - grab any remaining stuff in FIFO */
-    while (remaining && (bcm2835_peri_read(status) & BCM2835_BSC_S_RXD))
+    while (remaining && (n = bcm2835_i2c_drain_fifo(i2c, buf + i, remaining)))
     {
-        /* Read from FIFO */
-        buf[i] = bcm2835_peri_read(fifo);
-        i++;
-        remaining--;
+        i += n;
+        remaining -= n;
     }
     
     /* Received a NACK */
@@ -886,6 +886,8 @@ typedef enum
 #define BCM2835_BSC_S_TA 		0x00000001 /*!< Transfer Active */
 
 #define BCM2835_BSC_FIFO_SIZE   	16 /*!< BSC FIFO size */
+#define BCM2835_I2C_TIMEOUT_SLACK_US	1000 /*!< Slack on top of twice the bus time before a transfer is given up, in us */
+#define BCM2835_I2C_POLLS_PER_CHECK	64 /*!< Status polls between two checks of the time a transfer has taken */
 
 /*! \brief bcm2835I2CClockDivider
   Specifies the divider used to generate the I2C clock from the system clock.
@@ -907,9 +909,39 @@ typedef enum
     BCM2835_I2C_REASON_OK   	     = 0x00,      /*!< Success */
     BCM2835_I2C_REASON_ERROR_NACK    = 0x01,      /*!< Received a NACK */
     BCM2835_I2C_REASON_ERROR_CLKT    = 0x02,      /*!< Received Clock Stretch Timeout */
-    BCM2835_I2C_REASON_ERROR_DATA    = 0x04       /*!< Not all data is sent / received */
+    BCM2835_I2C_REASON_ERROR_DATA    = 0x04,      /*!< Not all data is sent / received */
+    BCM2835_I2C_REASON_ERROR_TIMEOUT = 0x08       /*!< The transfer ran out of its budget, twice its bus time for the library functions */
 } bcm2835I2CReasonCodes;
 
+/*! \brief bcm2835I2CBus
+  Specifies which BSC controller a bcm2835I2C handle drives.
+*/
+typedef enum
+{
+    BCM2835_I2C_BSC0 = 0, /*!< BSC0, SDA0/SCL0 on GPIO 0/1 (P1-03/P1-05 on V1 RPi) */
+    BCM2835_I2C_BSC1 = 1  /*!< BSC1, SDA1/SCL1 on GPIO 2/3 (P1-03/P1-05 on V2 RPi) */
+} bcm2835I2CBus;
+
+/*! \brief bcm2835I2C
+  Handle on one BSC controller, passed to all the bcm2835_i2c_* functions.
+  Initialised by bcm2835_i2c_begin().
+  The handle shadows the A, DIV, DEL and CLKT registers: the setters only write them
+  when the value changes, so the registers must not be written behind its back.
+*/
+typedef struct
+{
+    volatile uint32_t* base; /*!< Base of the BSC registers */
+    uint8_t sda;             /*!< SDA pin */
+    uint8_t scl;             /*!< SCL pin */
+    uint8_t addr;            /*!< Slave address programmed in A */
+    uint16_t divider;        /*!< Clock divider programmed in DIV, 0 stands for 32768 */
+    uint32_t del;            /*!< Data delays programmed in DEL, FEDL in the upper 16 bits, REDL in the lower ones */
+    uint16_t clkt;           /*!< Clock stretch timeout programmed in CLKT, in SCL cycles */
+    uint32_t core_clk_hz;    /*!< Rate of the core clock feeding the controller, in Hz */
+    uint32_t byte_time_ns;   /*!< Time needed to transmit one byte (8 bits + ACK), in nanoseconds */
+    uint32_t byte_wait_us;   /*!< Same as byte_time_ns, in microseconds, rounded up */
+} bcm2835I2C;
+
 /* Defines for ST
    GPIO register offsets from BCM2835_ST_BASE.
    Offsets into the ST Peripheral block in bytes per 12.1 System Timer Registers
@@ -1462,30 +1494,35 @@ extern "C" {
     */
 
     /*! Start I2C operations.
-      Forces RPi I2C pins P1-03 (SDA) and P1-05 (SCL)
+      Initialises the handle for the given BSC controller, and forces its SDA and SCL pins
       to alternate function ALT0, which enables those pins for I2C interface.
       You should call bcm2835_i2c_end() when all I2C functions are complete to return the pins to
       their default functions
+      \param[out] i2c The handle to initialise.
+      \param[in] bus The BSC controller, see \ref bcm2835I2CBus
       \sa  bcm2835_i2c_end()
     */
-    extern void bcm2835_i2c_begin(void);
+    extern void bcm2835_i2c_begin(bcm2835I2C* i2c, uint8_t bus);
 
     /*! End I2C operations.
-      I2C pins P1-03 (SDA) and P1-05 (SCL)
+      The SDA and SCL pins of the controller
       are returned to their default INPUT behaviour.
+      \param[in] i2c The BSC controller.
     */
-    extern void bcm2835_i2c_end(void);
+    extern void bcm2835_i2c_end(bcm2835I2C* i2c);
 
     /*! Sets the I2C slave address.
+      \param[in] i2c The BSC controller.
       \param[in] addr The I2C slave address.
     */
-    extern void bcm2835_i2c_setSlaveAddress(uint8_t addr);
+    extern void bcm2835_i2c_setSlaveAddress(bcm2835I2C* i2c, uint8_t addr);
 
     /*! Sets the I2C clock divider and therefore the I2C clock speed.
+      \param[in] i2c The BSC controller.
       \param[in] divider The desired I2C clock divider, one of BCM2835_I2C_CLOCK_DIVIDER_*,
       see \ref bcm2835I2CClockDivider
     */
-    extern void bcm2835_i2c_setClockDivider(uint16_t divider);
+    extern void bcm2835_i2c_setClockDivider(bcm2835I2C* i2c, uint16_t divider);
 
     /*! Sets the I2C clock divider by converting the baudrate parameter to
       the equivalent I2C clock divider. ( see \sa bcm2835_i2c_setClockDivider)
@@ -1493,23 +1530,71 @@ extern "C" {
       The use of baudrate corresponds to its use in the I2C kernel device
       driver. (Of course, bcm2835 has nothing to do with the kernel driver)
     */
-    extern void bcm2835_i2c_set_baudrate(uint32_t baudrate);
+    extern void bcm2835_i2c_set_baudrate(bcm2835I2C* i2c, uint32_t baudrate);
+
+    /*! Tells the controller handle the rate of the core clock, when it is not BCM2835_CORE_CLK_HZ
+      or after it changed. DIV is left untouched: the byte time is recomputed for the programmed
+      divider and bcm2835_i2c_set_baudrate() uses the new rate from then on.
+      \param[in] i2c The BSC controller.
+      \param[in] core_clk_hz Rate of the core clock, in Hz.
+    */
+    extern void bcm2835_i2c_setCoreClock(bcm2835I2C* i2c, uint32_t core_clk_hz);
+
+    /*! Sets the I2C data delays: the number of core clocks the controller waits after a falling
+      edge of SCL before outputting the next bit (fedl), and after a rising edge before sampling
+      the bit (redl). Both must be less than half the clock divider.
+      \param[in] i2c The BSC controller.
+      \param[in] fedl Falling edge delay.
+      \param[in] redl Rising edge delay.
+    */
+    extern void bcm2835_i2c_setDataDelay(bcm2835I2C* i2c, uint16_t fedl, uint16_t redl);
+
+    /*! Sets the number of SCL clock cycles a slave may stretch the clock before the transfer
+      is ended with BCM2835_I2C_REASON_ERROR_CLKT. 0 disables the timeout.
+      \param[in] i2c The BSC controller.
+      \param[in] timeout Clock stretch timeout, in SCL cycles.
+    */
+    extern void bcm2835_i2c_setClockStretchTimeout(bcm2835I2C* i2c, uint16_t timeout);
+
+    /*! Writes to the FIFO as many bytes as it accepts, up to len, with relaxed accesses and a single
+      memory barrier once the batch is written. An empty FIFO (TXE) takes BCM2835_BSC_FIFO_SIZE bytes
+      without checking the status again, otherwise TXD is checked before each byte.
+      The last access to another peripheral must have been followed by a barrier.
+      \param[in] i2c The BSC controller.
+      \param[in] buf Bytes to write.
+      \param[in] len Number of bytes available in buf.
+      \return Number of bytes written.
+    */
+    extern uint32_t bcm2835_i2c_fill_fifo(bcm2835I2C* i2c, const char* buf, uint32_t len);
+
+    /*! Reads from the FIFO as many bytes as it holds, up to len, with relaxed accesses and a single
+      memory barrier once the batch is read. A full FIFO (RXF) gives BCM2835_BSC_FIFO_SIZE bytes
+      without checking the status again, otherwise RXD is checked before each byte.
+      The last access to another peripheral must have been followed by a barrier.
+      \param[in] i2c The BSC controller.
+      \param[out] buf Room for the bytes read.
+      \param[in] len Number of bytes wanted.
+      \return Number of bytes read.
+    */
+    extern uint32_t bcm2835_i2c_drain_fifo(bcm2835I2C* i2c, char* buf, uint32_t len);
 
     /*! Transfers any number of bytes to the currently selected I2C slave.
       (as previously set by \sa bcm2835_i2c_setSlaveAddress)
+      \param[in] i2c The BSC controller.
       \param[in] buf Buffer of bytes to send.
       \param[in] len Number of bytes in the buf buffer, and the number of bytes to send.
       \return reason see \ref bcm2835I2CReasonCodes
     */
-    extern uint8_t bcm2835_i2c_write(const char * buf, uint32_t len);
+    extern uint8_t bcm2835_i2c_write(bcm2835I2C* i2c, const char * buf, uint32_t len);
 
     /*! Transfers any number of bytes from the currently selected I2C slave.
       (as previously set by \sa bcm2835_i2c_setSlaveAddress)
+      \param[in] i2c The BSC controller.
       \param[in] buf Buffer of bytes to receive.
       \param[in] len Number of bytes in the buf buffer, and the number of bytes to received.
       \return reason see \ref bcm2835I2CReasonCodes
     */
-    extern uint8_t bcm2835_i2c_read(char* buf, uint32_t len);
+    extern uint8_t bcm2835_i2c_read(bcm2835I2C* i2c, char* buf, uint32_t len);
 
     /*! Allows reading from I2C slaves that require a repeated start (without any prior stop)
       to read after the required slave register has been set. For example, the popular
@@ -1520,24 +1605,26 @@ extern "C" {
       \sa bcm2835_i2c_read
       are a better choice.
       Will read from the slave previously set by \sa bcm2835_i2c_setSlaveAddress
+      \param[in] i2c The BSC controller.
       \param[in] regaddr Buffer containing the slave register you wish to read from.
       \param[in] buf Buffer of bytes to receive.
       \param[in] len Number of bytes in the buf buffer, and the number of bytes to received.
       \return reason see \ref bcm2835I2CReasonCodes
     */
-    extern uint8_t bcm2835_i2c_read_register_rs(char* regaddr, char* buf, uint32_t len);
+    extern uint8_t bcm2835_i2c_read_register_rs(bcm2835I2C* i2c, char* regaddr, char* buf, uint32_t len);
 
     /*! Allows sending an arbitrary number of bytes to I2C slaves before issuing a repeated
       start (with no prior stop) and reading a response.
       Necessary for devices that require such behavior, such as the MLX90620.
       Will write to and read from the slave previously set by \sa bcm2835_i2c_setSlaveAddress
+      \param[in] i2c The BSC controller.
       \param[in] cmds Buffer containing the bytes to send before the repeated start condition.
       \param[in] cmds_len Number of bytes to send from cmds buffer
       \param[in] buf Buffer of bytes to receive.
       \param[in] buf_len Number of bytes to receive in the buf buffer.
       \return reason see \ref bcm2835I2CReasonCodes
     */
-    extern uint8_t bcm2835_i2c_write_read_rs(char* cmds, uint32_t cmds_len, char* buf, uint32_t buf_len);
+    extern uint8_t bcm2835_i2c_write_read_rs(bcm2835I2C* i2c, char* cmds, uint32_t cmds_len, char* buf, uint32_t buf_len);
 
     /*! @} */
 
@@ -0,0 +1,161 @@
+/**
+ * Tracepoints of the I2C transfer engine.
+ *
+ * They cost a patched-out branch while disabled, and record a binary event in the ftrace ring buffer
+ * while enabled, so they can be left on in production:
+ *     echo 1 > /sys/kernel/debug/tracing/events/i2c_bcm283x/enable
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM i2c_bcm283x
+
+#if !defined(_I2C_BCM283X_RTDM_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _I2C_BCM283X_RTDM_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/**
+ * A transfer takes the bus: START of its first segment.
+ */
+TRACE_EVENT(i2c_bcm283x_xfer_start,
+	TP_PROTO(int bus, int nsegs, uint16_t divider),
+	TP_ARGS(bus, nsegs, divider),
+	TP_STRUCT__entry(
+		__field(int, bus)
+		__field(int, nsegs)
+		__field(uint16_t, divider)
+	),
+	TP_fast_assign(
+		__entry->bus = bus;
+		__entry->nsegs = nsegs;
+		__entry->divider = divider;
+	),
+	TP_printk("bus=%d nsegs=%d divider=%u", __entry->bus, __entry->nsegs, __entry->divider)
+);
+
+/**
+ * A segment is programmed, with a START or a repeated start.
+ */
+TRACE_EVENT(i2c_bcm283x_segment,
+	TP_PROTO(int bus, uint8_t addr, uint16_t flags, uint16_t len),
+	TP_ARGS(bus, addr, flags, len),
+	TP_STRUCT__entry(
+		__field(int, bus)
+		__field(uint8_t, addr)
+		__field(uint16_t, flags)
+		__field(uint16_t, len)
+	),
+	TP_fast_assign(
+		__entry->bus = bus;
+		__entry->addr = addr;
+		__entry->flags = flags;
+		__entry->len = len;
+	),
+	TP_printk("bus=%d addr=0x%02x flags=0x%04x len=%u", __entry->bus, __entry->addr, __entry->flags, __entry->len)
+);
+
+/**
+ * A batch of bytes moved between the FIFO and the segment buffer.
+ */
+TRACE_EVENT(i2c_bcm283x_fifo,
+	TP_PROTO(int bus, int read, uint32_t count, uint32_t remaining),
+	TP_ARGS(bus, read, count, remaining),
+	TP_STRUCT__entry(
+		__field(int, bus)
+		__field(int, read)
+		__field(uint32_t, count)
+		__field(uint32_t, remaining)
+	),
+	TP_fast_assign(
+		__entry->bus = bus;
+		__entry->read = read;
+		__entry->count = count;
+		__entry->remaining = remaining;
+	),
+	TP_printk("bus=%d %s count=%u remaining=%u", __entry->bus, __entry->read ? "drain" : "fill",
+		__entry->count, __entry->remaining)
+);
+
+/**
+ * A transfer failed on the bus, or was aborted (reason 0xff).
+ */
+TRACE_EVENT(i2c_bcm283x_error,
+	TP_PROTO(int bus, uint8_t reason, uint8_t addr, uint32_t remaining),
+	TP_ARGS(bus, reason, addr, remaining),
+	TP_STRUCT__entry(
+		__field(int, bus)
+		__field(uint8_t, reason)
+		__field(uint8_t, addr)
+		__field(uint32_t, remaining)
+	),
+	TP_fast_assign(
+		__entry->bus = bus;
+		__entry->reason = reason;
+		__entry->addr = addr;
+		__entry->remaining = remaining;
+	),
+	TP_printk("bus=%d reason=0x%02x addr=0x%02x remaining=%u", __entry->bus, __entry->reason, __entry->addr,
+		__entry->remaining)
+);
+
+/**
+ * The payload of a segment, once written or read.
+ */
+TRACE_EVENT(i2c_bcm283x_data,
+	TP_PROTO(int bus, uint8_t addr, uint16_t flags, const char *buf, uint16_t len),
+	TP_ARGS(bus, addr, flags, buf, len),
+	TP_STRUCT__entry(
+		__field(int, bus)
+		__field(uint8_t, addr)
+		__field(uint16_t, flags)
+		__field(uint16_t, len)
+		__dynamic_array(uint8_t, buf, len)
+	),
+	TP_fast_assign(
+		__entry->bus = bus;
+		__entry->addr = addr;
+		__entry->flags = flags;
+		__entry->len = len;
+		memcpy(__get_dynamic_array(buf), buf, len);
+	),
+	TP_printk("bus=%d addr=0x%02x flags=0x%04x len=%u [%*phD]", __entry->bus, __entry->addr, __entry->flags,
+		__entry->len, __entry->len, __get_dynamic_array(buf))
+);
+
+/**
+ * A transfer releases the bus.
+ */
+TRACE_EVENT(i2c_bcm283x_xfer_done,
+	TP_PROTO(int bus, int res, int64_t duration_ns),
+	TP_ARGS(bus, res, duration_ns),
+	TP_STRUCT__entry(
+		__field(int, bus)
+		__field(int, res)
+		__field(int64_t, duration_ns)
+	),
+	TP_fast_assign(
+		__entry->bus = bus;
+		__entry->res = res;
+		__entry->duration_ns = duration_ns;
+	),
+	TP_printk("bus=%d res=%d duration=%lldns", __entry->bus, __entry->res, __entry->duration_ns)
+);
+
+#endif /* _I2C_BCM283X_RTDM_TRACE_H */
+
+/* Outside the guard, define_trace.h reads this file again from the directory of the driver */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE i2c-bcm283x-rtdm-trace
+#include <trace/define_trace.h>
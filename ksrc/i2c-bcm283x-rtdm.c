@@ -33,6 +33,23 @@
 #include <linux/printk.h>
 #include <linux/init.h>
 #include <linux/errno.h>
+#include <linux/math64.h>
+#include <linux/of.h>
+#include <linux/of_irq.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/gfp.h>
+#include <linux/atomic.h>
+#include <linux/list.h>
+#include <linux/clk.h>
+#include <linux/notifier.h>
+#include <linux/gpio.h>
+#include <linux/gpio/driver.h>
+#include <linux/irq.h>
+#include <linux/delay.h>
+#include <linux/mutex.h>
+#include <linux/version.h>
 
 /* RTDM headers */
 #include <rtdm/rtdm.h>
@@ -41,6 +58,17 @@
 /* BCM2835 library header */
 #include "bcm2835.h"
 
+/* Tracepoints, instantiated here */
+#define CREATE_TRACE_POINTS
+#include "i2c-bcm283x-rtdm-trace.h"
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 3, 0)
+/* The flags of a mapping are only written through helpers from 6.3 on */
+static inline void vm_flags_clear(struct vm_area_struct *vma, vm_flags_t flags) {
+	vma->vm_flags &= ~flags;
+}
+#endif
+
 /**
  * Buffer type.
  */
@@ -49,6 +77,14 @@ typedef struct buffer_s {
 	char data[BCM283X_I2C_BUFFER_SIZE_MAX];
 } buffer_t;
 
+/**
+ * I2C bus speed, either an SCL rate or a clock divider of the nominal core clock.
+ */
+typedef struct speed_s {
+	uint32_t bus_hz; // SCL rate, used if divider is 0
+	uint16_t divider; // Clock divider at BCM2835_CORE_CLK_HZ, scaled with the actual core clock
+} speed_t;
+
 /**
  * Device config structure stored inside each context.
  */
@@ -59,380 +95,3782 @@ typedef struct config_s {
 	uint8_t cmds_size;
 	int baudrate;
 	int clock_divider;
-	uint8_t flags; // bit [0] -> READ REPEATED START | bit [1] -> WRITE REPEATED START | bit [2] -> DEBUG MODE | bit [3] -> RECONFIGURE DEVICE EACH WRITE/READ
+	speed_t speed; // Speed applied to the bus by each transaction, from clock_divider, baudrate or bus speed
+	nanosecs_rel_t relative_deadline; // Deadline of each transaction from its submission, 0 for none
+	nanosecs_abs_t absolute_deadline; // Deadline of the next transaction only, BCM283X_I2C_NO_DEADLINE for none
+	nanosecs_rel_t budget; // Wall-clock budget of each transfer, 0 for none
+	bcm283x_i2c_retry_t retry; // Retry policy of the transactions, run again on transient errors
+	int drdy_gpio; // Data-ready GPIO triggering the sampler, -1 to sample periodically
+	uint8_t flags; // bit [0] -> READ REPEATED START | bit [1] -> WRITE REPEATED START | bit [2] -> DEBUG MODE (config changes, transfers are traced by the tracepoints) | bit [3] -> unused, the config is applied by each transaction
 } config_t;
 
+/**
+ * Pages shared with user space through mmap. They are released once the device
+ * instance is closed and every mapping is gone.
+ */
+typedef struct shm_s {
+	void *va;
+	size_t size;
+	atomic_t refs;
+} shm_t;
+
+/**
+ * Submission and completion rings, consumed and produced by the poller task.
+ */
+typedef struct ring_s {
+	shm_t *shm;
+	uint32_t entries;
+	nanosecs_rel_t poll_ns;
+	nanosecs_rel_t idle_ns;
+	speed_t speed; // Config of the instance at setup, the poller doesn't touch the live one
+	nanosecs_rel_t budget;
+	nanosecs_rel_t relative_deadline;
+	bcm283x_i2c_retry_t retry;
+	rtdm_event_t wakeup;
+	rtdm_task_t poller;
+} ring_t;
+
+/**
+ * Registered buffers, shared with user space and used in place by the transfers.
+ */
+typedef struct pool_s {
+	shm_t *shm;
+	uint32_t count;
+	uint32_t stride;
+} pool_t;
+
+/**
+ * Periodic or data-ready triggered sampler. The task produces at tail, the reader consumes at head.
+ */
+typedef struct sampler_s {
+	struct i2c_bcm283x_bus_s *bus; // Bus of the device instance that started the sampler
+	speed_t speed;
+	nanosecs_rel_t budget;
+	nanosecs_rel_t period; // Sampling period, also the relative deadline of each read
+	uint8_t addr;
+	char reg;
+	uint8_t len;
+	uint32_t entries;
+	bcm283x_i2c_sample_t *samples;
+	uint32_t head;
+	uint32_t tail;
+	uint32_t seq;
+	uint32_t wanted; // Number of samples the reader waits for
+	int running;
+	rtdm_event_t ready;
+	rtdm_mutex_t read_lock;
+	atomic_t readers; // Readers inside bcm283x_i2c_sampler_read()
+	int resetting; // Set while a restart replaces the buffer, readers back off
+	rtdm_task_t task;
+	int drdy_gpio; // Data-ready GPIO, -1 when sampling periodically
+	unsigned int drdy_num; // Global number of the data-ready GPIO, from the base of the SoC GPIO controller
+	unsigned int drdy_irq;
+	rtdm_irq_t drdy_handle;
+	rtdm_event_t drdy; // Signaled on each data-ready edge
+	uint64_t edge; // System timer (us) at the last data-ready edge
+} sampler_t;
+
+/**
+ * CRC-8 checking of the data of a device instance.
+ */
+typedef struct crc_s {
+	uint8_t mode; // BCM283X_I2C_CRC_* mode
+	uint8_t init;
+	uint8_t word_len;
+	uint8_t table[256]; // CRC of each byte value, for the polynomial in use
+} crc_t;
+
+/**
+ * State of a cached register.
+ */
+#define REG_VALID 0x01 // The cache holds the value of the register
+#define REG_DIRTY 0x02 // The value was changed in the cache only
+
+/**
+ * Register cache of the slave of a device instance.
+ */
+typedef struct regmap_s {
+	int enabled;
+	uint8_t addr; // Slave the cache belongs to
+	uint8_t type[256]; // BCM283X_I2C_REG_* type of each register
+	uint8_t state[256]; // REG_* state of each register
+	uint8_t value[256];
+} regmap_t;
+
+/**
+ * Deadline scheduling of a device instance, shared by its system calls which may run concurrently.
+ */
+typedef struct sched_s {
+	rtdm_lock_t lock; // Protects the deadlines of the configuration and the statistics
+	bcm283x_i2c_sched_stats_t stats; // Lateness of the transactions that had a deadline
+} sched_t;
+
 /**
  * Device context, associated with every open device instance.
  */
 typedef struct i2c_bcm283x_context_s {
+	struct i2c_bcm283x_bus_s *bus; // Bus of the device instance, selected by its minor
 	config_t config;
 	buffer_t transmit_buffer;
 	buffer_t receive_buffer;
+	ring_t *ring;
+	pool_t *pool;
+	sampler_t *sampler;
+	struct mutex setup_lock; // Serializes the setup and release of the rings, pool and sampler, secondary mode only
+	rtdm_mutex_t data_lock; // Serializes the real-time system calls using the staging buffers or the configuration
+	sched_t sched;
+	crc_t crc; // CRC checking of the data
+	regmap_t regmap;
 } i2c_bcm283x_context_t;
 
 /**
- * This structure contain the RTDM device created for I2C/BSC1 (position [0]).
+ * Segment flag: data is read from the slave. Segments without it are written to the slave.
  */
-static struct rtdm_device i2c_bcm283x_devices[1];
+#define SEGMENT_READ BCM283X_I2C_M_RD
 
 /**
- * Open handler. Note: opening a named device instance always happens from secondary mode.
- * @param[in] fd File descriptor associated with opened device instance.
- * @param[in] oflags Open flags as passed by the user.
- * @return 0 on success. On failure, a negative error code is returned.
+ * One part of a bus transaction, opened by a START (or a repeated START).
  */
-static int bcm283x_i2c_rtdm_open(struct rtdm_fd *fd, int oflags) {
+typedef struct segment_s {
+	uint8_t addr;
+	uint16_t flags;
+	uint16_t len;
+	char *buf;
+} segment_t;
 
-	i2c_bcm283x_context_t *context;
+/**
+ * Slack added to twice the computed duration of a transfer before it is considered lost.
+ */
+#define BCM283X_I2C_TIMEOUT_SLACK_NS 1000000
 
-	/* Retrieve context */
-	context = (i2c_bcm283x_context_t *) rtdm_fd_to_private(fd);
+/**
+ * Time before the expected end of a polled transfer from which the status is polled instead of sleeping,
+ * it covers the wake-up latency of the caller.
+ */
+#define BCM283X_I2C_POLL_TAIL_NS 20000
 
-	/* Set default clock config */
-	context->config.clock_divider = BCM2835_I2C_CLOCK_DIVIDER_626;
-	
-	/* Set flags */
-	context->config.flags = oflags;
-	
-	return 0;
+/**
+ * Deadline of the transactions that have none, they are dispatched after all the others.
+ */
+#define BCM283X_I2C_NO_DEADLINE ((nanosecs_abs_t)-1)
 
-}
+/**
+ * Timestamps of a transfer on the System Timer, in microseconds.
+ */
+typedef struct timestamps_s {
+	uint64_t start; // START issued
+	uint64_t first; // First FIFO event
+	uint64_t done; // Transfer over, 0 if it didn't complete
+} timestamps_t;
 
 /**
- * Close handler. Note: closing a device instance always happens from secondary mode.
- * @param[in] fd File descriptor associated with opened device instance.
- * @return 0 on success. On failure return a negative error code.
+ * How a transaction is to be run.
  */
-static void bcm283x_i2c_rtdm_close(struct rtdm_fd *fd) {
+typedef struct request_s {
+	speed_t speed; // Speed to run the transaction at
+	nanosecs_abs_t deadline; // Absolute deadline on the monotonic clock, orders the transactions waiting for the bus
+	sched_t *sched; // Where to report lateness, NULL if not needed
+	nanosecs_rel_t budget; // Wall-clock budget of the transfer once it has the bus, 0 for none
+	timestamps_t *ts; // Where to timestamp the transfer, NULL if not needed
+	uint8_t op; // BCM283X_I2C_OP_* type, for the histograms
+} request_t;
 
-	return;
+/**
+ * A transaction waiting for the bus.
+ */
+typedef struct waiter_s {
+	struct list_head node;
+	nanosecs_abs_t deadline;
+	rtdm_event_t event; // Signaled when the waiter may have become the head of the queue
+} waiter_t;
+
+/**
+ * Controller state of a bus, shared between the transfer engine and the BSC interrupt handler.
+ * Nothing on the transfer path is shared between buses.
+ */
+typedef struct i2c_bcm283x_bus_s {
+	bcm2835I2C i2c; // BSC registers, cached clock divider and byte time
+	unsigned int irq; // Linux IRQ number of the BSC interrupt, 0 when transfers are polled
+	rtdm_irq_t irq_handle;
+	rtdm_mutex_t owner; // Held by the transaction owning the bus, which inherits the priority of the next one
+	rtdm_lock_t gate_lock; // Protects waiters and stats
+	struct list_head waiters; // Transactions waiting for the bus, by earliest deadline
+	bcm283x_i2c_stats_t stats;
+	struct shm_s *stats_shm; // Statistics page shared with user space, NULL if out of memory
+	atomic_t hist[BCM283X_I2C_OPS][BCM283X_I2C_HISTS][BCM283X_I2C_HIST_BUCKETS]; // Latency histograms, updated without lock
+	rtdm_lock_t xfer_lock; // Protects the transfer in progress against the interrupt handler
+	rtdm_event_t done; // Signaled by the interrupt handler once the transfer is over
+	segment_t *seg; // Segment in progress, NULL when idle
+	int segs_left; // Segments following the one in progress
+	char *pos;
+	uint32_t remaining;
+	uint8_t reason;
+	timestamps_t *ts; // Timestamps of the transfer in progress, NULL if not needed
+	int clocked; // Set while the owner relies on the rate of the core clock, protected by xfer_lock
+} i2c_bcm283x_bus_t;
+
+/**
+ * Number of BSC controllers that can be exposed, one device each.
+ */
+#define BCM283X_I2C_BUS_COUNT 2
+
+/**
+ * BSC controller driven by each device minor. Minor 0 stays on the P1 header bus, BSC0 comes after it.
+ */
+static const uint8_t i2c_bcm283x_bsc[BCM283X_I2C_BUS_COUNT] = { BCM2835_I2C_BSC1, BCM2835_I2C_BSC0 };
+
+/**
+ * Whether BSC0 is exposed. Its pins carry the HAT ID EEPROM and may be claimed by other drivers,
+ * so they are only taken over on request.
+ */
+static bool bsc0;
+module_param(bsc0, bool, 0444);
+MODULE_PARM_DESC(bsc0, "Expose BSC0 (GPIO 0/1) as i2cdev0.1 (default: no)");
+
+/**
+ * Number of devices registered, 2 with BSC0.
+ */
+static int i2c_bcm283x_bus_count;
+
+/**
+ * This structure contain the RTDM devices created for I2C/BSC1 (position [0]) and I2C/BSC0 (position [1]).
+ */
+static struct rtdm_device i2c_bcm283x_devices[BCM283X_I2C_BUS_COUNT];
+
+/**
+ * State of the buses driven by the devices, indexed by device minor.
+ */
+static i2c_bcm283x_bus_t i2c_bcm283x_buses[BCM283X_I2C_BUS_COUNT];
+
+/**
+ * The core clock feeding the BSC controllers, NULL if it isn't known to the clock framework.
+ */
+static struct clk *i2c_bcm283x_clk;
+
+/**
+ * Last known rate of the core clock, in Hz. Updated by the rate change notifier, picked up by the buses
+ * on their next transaction.
+ */
+static unsigned long i2c_bcm283x_clk_hz = BCM2835_CORE_CLK_HZ;
+
+/**
+ * Set while the rate of the core clock changes. Transactions wait for the new rate before programming
+ * their divider, the change waits for the transactions that started before it.
+ */
+static int i2c_bcm283x_clk_changing;
+
+/**
+ * How long a transaction sleeps between two checks while the rate of the core clock changes.
+ */
+#define BCM283X_I2C_CLK_HOLD_NS 100000
+
+/**
+ * Correlation of the System Timer with rtdm_clock_read(), refreshed when timestamps are requested.
+ */
+typedef struct clock_map_s {
+	rtdm_lock_t lock;
+	uint64_t st; // System Timer (us) at the reference point, 0 until the first refresh
+	nanosecs_abs_t ns; // rtdm_clock_read() at the reference point
+	uint32_t mult; // Nanoseconds per System Timer tick, in 1/65536
+} clock_map_t;
+
+static clock_map_t i2c_bcm283x_clock_map;
+
+/**
+ * Shortest interval between two measurements of the drift, in System Timer ticks.
+ */
+#define BCM283X_I2C_CLOCK_MAP_PERIOD_US 1000000
+
+/**
+ * Nominal rate of the System Timer, in nanoseconds per tick in 1/65536.
+ */
+#define BCM283X_I2C_CLOCK_MAP_MULT (1000 << 16)
+
+/**
+ * Address of a BSC register of a bus.
+ */
+#define BSC_REG(bus, reg) ((bus)->i2c.base + (reg)/4)
+
+/**
+ * Index of a bus, as reported by the tracepoints.
+ */
+#define BSC_ID(bus) ((int)((bus) - i2c_bcm283x_buses))
+
+/**
+ * Writes to the FIFO as many bytes of the current segment as it accepts.
+ * @param bus The bus, with its transfer lock held.
+ */
+static void bcm283x_i2c_fill_fifo(i2c_bcm283x_bus_t *bus) {
+
+	uint32_t n;
+
+	/* Relaxed accesses, one barrier per batch */
+	n = bcm2835_i2c_fill_fifo(&bus->i2c, bus->pos, bus->remaining);
+	bus->pos += n;
+	bus->remaining -= n;
+	trace_i2c_bcm283x_fifo(BSC_ID(bus), 0, n, bus->remaining);
 
 }
 
 /**
- * Read from the device. If the bit [0] of flags is activated repeated start is enabled.
- * @param[in] fd File descriptor.
- * @param[out] buf Input buffer as passed by the user.
- * @param[in] size Number of bytes the user requests to read.
- * @return On success, the number of bytes read. On failure return either -ENOSYS, to request that this handler be called again from the opposite realtime/non-realtime context, or another negative error code.
+ * Programs the BSC for the current segment and issues a START. When called while the
+ * previous write segment is still on the wire, the START is sent as a repeated start.
+ * Segments that fit in the FIFO are pre-loaded or drained at once, and only raise DONE.
+ * Larger segments also raise TXW or RXR each time the FIFO crosses its threshold.
+ * @param bus The bus, with its transfer lock held.
+ * @param fifo_empty Whether the FIFO holds no data of a previous segment.
  */
-static ssize_t bcm283x_i2c_rtdm_read_rt(struct rtdm_fd *fd, void __user *buf, size_t size) {
+static void bcm283x_i2c_start_segment(i2c_bcm283x_bus_t *bus, int fifo_empty) {
 
-	i2c_bcm283x_context_t *context;
-	int res, i;
+	segment_t *seg = bus->seg;
+	uint32_t control = BCM2835_BSC_C_I2CEN | BCM2835_BSC_C_ST;
 
-	/* Retrieve context */
-	context = (i2c_bcm283x_context_t *) rtdm_fd_to_private(fd);
+	bus->pos = seg->buf;
+	bus->remaining = seg->len;
+	trace_i2c_bcm283x_segment(BSC_ID(bus), seg->addr, seg->flags, seg->len);
 
-	/* Limit size */
-	context->receive_buffer.size = (size > BCM283X_I2C_BUFFER_SIZE_MAX) ? BCM283X_I2C_BUFFER_SIZE_MAX : size;
-	
-	//DEBUG OUTPUT 
-	if(context->config.flags&4)
-		printk(KERN_DEBUG "%s: READ_SIZE (%d).\r\n", __FUNCTION__, size);
-	
-	/*  Reconfigure device  */
-	if(context->config.flags&8){
-		
-		/* Set slave address */
-		bcm2835_i2c_setSlaveAddress(context->config.slave_address);
-		
-		/*  Set bus speed  */
-		if (context->config.clock_divider == 0)
-			bcm2835_i2c_set_baudrate((uint32_t)context->config.baudrate);
-		else
-			bcm2835_i2c_setClockDivider((uint16_t)context->config.clock_divider);
-	
+	bcm2835_i2c_setSlaveAddress(&bus->i2c, seg->addr);
+	bcm2835_peri_write(BSC_REG(bus, BCM2835_BSC_DLEN), seg->len);
+
+	if (seg->flags & SEGMENT_READ) {
+		control |= BCM2835_BSC_C_READ | BCM2835_BSC_C_INTD;
+		if (seg->len > BCM2835_BSC_FIFO_SIZE)
+			control |= BCM2835_BSC_C_INTR;
+	} else if (bus->segs_left == 0) {
+		control |= BCM2835_BSC_C_INTD;
+		if (fifo_empty)
+			bcm283x_i2c_fill_fifo(bus);
+		if (bus->remaining)
+			control |= BCM2835_BSC_C_INTT;
+	} else if (seg->len > 0) {
+		/* The next segment is chained from the TXW interrupt, once the last bytes are queued */
+		control |= BCM2835_BSC_C_INTT;
+		/* Without the interrupt, nothing would feed the FIFO before the caller first wakes up */
+		if (!bus->irq && fifo_empty)
+			bcm283x_i2c_fill_fifo(bus);
+	} else {
+		control |= BCM2835_BSC_C_INTD;
 	}
-	
-	/* Select between normal read or with repeated start */
-	if(!(context->config.flags&1))
-		res = bcm2835_i2c_read(context->receive_buffer.data, context->receive_buffer.size);
-	else if(context->config.register_address > 0)
-		res = bcm2835_i2c_read_register_rs(&context->config.register_address, context->receive_buffer.data, context->receive_buffer.size);	
 
-	//DEBUG OUTPUT
-	if(context->config.flags&4)
-		printk(KERN_DEBUG "%s: READ_RETURN_CODE (0x%02x).\r\n", __FUNCTION__, res);
+	/* Without the interrupt, the status is polled */
+	if (!bus->irq)
+		control &= ~(BCM2835_BSC_C_INTR | BCM2835_BSC_C_INTT | BCM2835_BSC_C_INTD);
 
-	//DEBUG OUTPUT
-	if(context->config.flags&4)
-		for (i=0; i < context->receive_buffer.size; i++)
-			printk(KERN_DEBUG "%s: <<READ (0x%02x).\r\n", __FUNCTION__, context->receive_buffer.data[i]);
+	bcm2835_peri_write(BSC_REG(bus, BCM2835_BSC_C), control);
 
-	/* Copy data to user space */
-	res = rtdm_safe_copy_to_user(fd, buf, (const void *)context->receive_buffer.data, context->receive_buffer.size);
-	if (res) {
-		printk(KERN_ERR "%s: Can't copy data from driver to user space (%d)!\r\n", __FUNCTION__, res);
-		return (res < 0) ? res : -res;
-	}
+}
 
-	/* Return read bytes */
-	return (ssize_t)context->receive_buffer.size;
+/**
+ * Moves to the next segment of the transfer in progress.
+ * @param bus The bus, with its transfer lock held.
+ * @param fifo_empty Whether the FIFO holds no data of the previous segment.
+ */
+static void bcm283x_i2c_next_segment(i2c_bcm283x_bus_t *bus, int fifo_empty) {
+
+	bus->seg++;
+	bus->segs_left--;
+	bcm283x_i2c_start_segment(bus, fifo_empty);
 
 }
 
 /**
- * Write to the device.
- * @param[in] fd File descriptor.
- * @param[in,out] buf Output buffer as passed by the user.
- * @param[in] size Number of bytes the user requests to write.
- * @return On success, the I2C return code. On failure return either -ENOSYS, to request that this handler be called again from the opposite realtime/non-realtime context, or another negative error code.
+ * Whether the current segment is a write whose bytes are all queued, waiting for the controller to go
+ * active before the next segment is chained with a repeated start. Only happens without the interrupt,
+ * when the whole segment was pre-loaded in the FIFO.
+ * @param bus The bus, with its transfer lock held and a transfer in progress.
+ * @return 1 if the next segment is to be chained, 0 otherwise.
  */
-static int bcm283x_i2c_rtdm_write_rt(struct rtdm_fd *fd, const void __user *buf, size_t size) {
+static int bcm283x_i2c_chain_pending(i2c_bcm283x_bus_t *bus) {
 
-	i2c_bcm283x_context_t *context;
-	int res, i;
+	return !bus->irq && bus->segs_left && bus->seg->len > 0 && !(bus->seg->flags & SEGMENT_READ) && !bus->remaining;
 
-	/* Retrieve context */
-	context = (i2c_bcm283x_context_t *) rtdm_fd_to_private(fd);
-	
-	/* Ensure that there will be enough space in the buffer */
-	if (size > BCM283X_I2C_BUFFER_SIZE_MAX) {
-		printk(KERN_ERR "%s: Trying to transmit data larger than buffer size !", __FUNCTION__);
-		return -EINVAL;
-	}
-	
-	context->transmit_buffer.size = size;
-	
-	//DEBUG OUTPUT
-	if(context->config.flags&4)
-		printk(KERN_DEBUG "%s: WRITE_SIZE (%d).\r\n", __FUNCTION__, context->transmit_buffer.size);
-	
-	/*  Reconfigure device  */
-	if(context->config.flags&8){
-		
-		/* Set slave address */
-		bcm2835_i2c_setSlaveAddress(context->config.slave_address);
-		
-		/*  Set bus speed  */
-		if (context->config.clock_divider == 0)
-			bcm2835_i2c_set_baudrate((uint32_t)context->config.baudrate);
-		else
-			bcm2835_i2c_setClockDivider((uint16_t)context->config.clock_divider);
-	
-	}
-	
-	/* Save data in kernel space buffer */
-	res = rtdm_safe_copy_from_user(fd, (void *)context->transmit_buffer.data, (const void *)buf, context->transmit_buffer.size);
-	if (res) {
-		printk(KERN_ERR "%s: Can't copy data from user space to driver (%d)!\r\n", __FUNCTION__, res);
-		return (res < 0) ? res : -res;
-	}
-	
-	//DEBUG OUTPUT
-	if(context->config.flags&4)
-		for (i=0; i < context->transmit_buffer.size; i++)
-			printk(KERN_DEBUG "%s: >>WRITE (0x%02x).\r\n", __FUNCTION__, context->transmit_buffer.data[i]);
+}
 
-	/* Select between normal write or with repeated start */
-	if(!(context->config.flags&2)){
-		bcm2835_i2c_write(context->transmit_buffer.data, context->transmit_buffer.size);
-		
-		//DEBUG OUTPUT
-		if(context->config.flags&4)
-			printk(KERN_DEBUG "%s: WRITE_RETURN_CODE (0x%02x).\r\n", __FUNCTION__, res);
+/**
+ * Reads from the FIFO the bytes received for the current segment.
+ * @param bus The bus, with its transfer lock held.
+ */
+static void bcm283x_i2c_drain_fifo(i2c_bcm283x_bus_t *bus) {
 
-	}else if(context->config.cmds_size > 0){
-	
-		res = bcm2835_i2c_write_read_rs(context->config.cmds, (uint32_t)context->config.cmds_size, context->transmit_buffer.data, (uint32_t)context->transmit_buffer.size);
+	uint32_t n;
+
+	/* Relaxed accesses, one barrier per batch */
+	n = bcm2835_i2c_drain_fifo(&bus->i2c, bus->pos, bus->remaining);
+	bus->pos += n;
+	bus->remaining -= n;
+	trace_i2c_bcm283x_fifo(BSC_ID(bus), 1, n, bus->remaining);
 
-		//DEBUG OUTPUT
-		if(context->config.flags&4)
-			printk(KERN_DEBUG "%s: WRITE_RETURN_CODE (0x%02x).\r\n", __FUNCTION__, res);
-		
-		/* Copy data to user space */
-		res = rtdm_safe_copy_to_user(fd, (void *)context->config.cmds, (const void *)context->transmit_buffer.data, context->transmit_buffer.size);
-		if (res) {
-			printk(KERN_ERR "%s: Can't copy data from driver to user space (%d)!\r\n", __FUNCTION__, res);
-			return (res < 0) ? res : -res;
-		}
-	}
-		
-	
-	/* Return bytes written */
-	return res;
 }
 
 /**
- * Changes the baudrate.
- * @param context The context associated with the device.
- * @param value An integer representing the baudrate.
- * @return 0 on success, -EINVAL if the specified value is invalid.
+ * Starts a transfer with its first segment, timestamping the START if requested.
+ * @param bus The bus, with its transfer lock held.
+ * @param segs The segments of the transfer.
+ * @param nsegs The number of segments, at least one.
  */
-static int bcm283x_i2c_change_baudrate(i2c_bcm283x_context_t *context, const int value) {
+static void bcm283x_i2c_launch(i2c_bcm283x_bus_t *bus, segment_t *segs, int nsegs) {
 
-	if(value > 0){
-		context->config.baudrate = value;
-		context->config.clock_divider = 0;
-		if(context->config.flags&4)
-			printk(KERN_DEBUG "%s: Changing baudrate to %d.\r\n", __FUNCTION__, value);
-		bcm2835_i2c_set_baudrate((uint32_t)context->config.baudrate);
-		return 0;
+	/* Clear FIFO and status */
+	bcm2835_peri_write(BSC_REG(bus, BCM2835_BSC_C), BCM2835_BSC_C_CLEAR_1);
+	bcm2835_peri_write(BSC_REG(bus, BCM2835_BSC_S), BCM2835_BSC_S_CLKT | BCM2835_BSC_S_ERR | BCM2835_BSC_S_DONE);
+
+	bus->seg = segs;
+	bus->segs_left = nsegs - 1;
+
+	if (bus->ts) {
+		bus->ts->first = 0;
+		bus->ts->done = 0;
+		bus->ts->start = bcm2835_st_read();
 	}
-	printk(KERN_ERR "%s: Unexpected value!\r\n", __FUNCTION__);
-	return -EINVAL;
+
+	trace_i2c_bcm283x_xfer_start(BSC_ID(bus), nsegs, bus->i2c.divider);
+	bcm283x_i2c_start_segment(bus, 1);
 
 }
 
 /**
- * Changes the clock divider.
- * @param context The context associated with the device.
- * @param value An integer representing a clock divider preference.
- * @return 0 on success, -EINVAL if the specified value is invalid.
+ * Ends the transfer in progress: disables the BSC and its interrupts, then wakes up the caller.
+ * @param bus The bus, with its transfer lock held.
+ * @param reason The I2C return code of the transfer.
  */
-static int bcm283x_i2c_change_clock_divider(i2c_bcm283x_context_t *context, const int value) {
+static void bcm283x_i2c_complete(i2c_bcm283x_bus_t *bus, uint8_t reason) {
+
+	if (bus->ts)
+		bus->ts->done = bcm2835_st_read();
+
+	if (reason != BCM2835_I2C_REASON_OK)
+		trace_i2c_bcm283x_error(BSC_ID(bus), reason, bus->seg->addr, bus->remaining);
+
+	bcm2835_peri_write(BSC_REG(bus, BCM2835_BSC_C), BCM2835_BSC_C_CLEAR_1);
+	bcm2835_peri_write(BSC_REG(bus, BCM2835_BSC_S), BCM2835_BSC_S_CLKT | BCM2835_BSC_S_ERR | BCM2835_BSC_S_DONE);
+
+	bus->seg = NULL;
+	bus->reason = reason;
+	rtdm_event_signal(&bus->done);
+
+}
+
+/**
+ * Aborts the transfer in progress: disables the BSC and its interrupts, without waking up the caller.
+ * @param bus The bus, with its transfer lock held and a transfer in progress.
+ */
+static void bcm283x_i2c_abort(i2c_bcm283x_bus_t *bus) {
+
+	trace_i2c_bcm283x_error(BSC_ID(bus), 0xff, bus->seg->addr, bus->remaining);
+
+	bcm2835_peri_write(BSC_REG(bus, BCM2835_BSC_C), BCM2835_BSC_C_CLEAR_1);
+	bcm2835_peri_write(BSC_REG(bus, BCM2835_BSC_S), BCM2835_BSC_S_CLKT | BCM2835_BSC_S_ERR | BCM2835_BSC_S_DONE);
+
+	bus->seg = NULL;
+
+}
+
+/**
+ * Advances the transfer in progress from the BSC status. Refills the FIFO on TXW, drains it on RXR,
+ * and either chains the next segment or completes the transfer on DONE.
+ * @param bus The bus, with its transfer lock held and a transfer in progress.
+ * @return 1 if the status called for an action, 0 otherwise.
+ */
+static int bcm283x_i2c_service(i2c_bcm283x_bus_t *bus) {
+
+	uint32_t status;
+	int res = 1;
+
+	status = bcm2835_peri_read(BSC_REG(bus, BCM2835_BSC_S));
+
+	if (bus->ts && !bus->ts->first && (status & (BCM2835_BSC_S_DONE | BCM2835_BSC_S_TXW | BCM2835_BSC_S_RXR)))
+		bus->ts->first = bcm2835_st_read();
+
+	if (status & BCM2835_BSC_S_ERR) {
+		bcm283x_i2c_complete(bus, BCM2835_I2C_REASON_ERROR_NACK);
+	} else if (status & BCM2835_BSC_S_CLKT) {
+		bcm283x_i2c_complete(bus, BCM2835_I2C_REASON_ERROR_CLKT);
+	} else if (status & BCM2835_BSC_S_DONE) {
+		if (bus->seg->flags & SEGMENT_READ)
+			bcm283x_i2c_drain_fifo(bus);
+		if (bus->remaining) {
+			bcm283x_i2c_complete(bus, BCM2835_I2C_REASON_ERROR_DATA);
+		} else if (bus->segs_left) {
+			/* The segment was closed by a STOP, open the next one with a new START */
+			bcm2835_peri_write(BSC_REG(bus, BCM2835_BSC_S), BCM2835_BSC_S_DONE);
+			bcm283x_i2c_next_segment(bus, 1);
+		} else {
+			bcm283x_i2c_complete(bus, BCM2835_I2C_REASON_OK);
+		}
+	} else if (status & BCM2835_BSC_S_TXW) {
+		if (!bus->remaining) {
+			bcm283x_i2c_complete(bus, BCM2835_I2C_REASON_ERROR_DATA);
+		} else {
+			bcm283x_i2c_fill_fifo(bus);
+			/* The last bytes are queued, chain the next segment with a repeated start */
+			if (!bus->remaining && bus->segs_left)
+				bcm283x_i2c_next_segment(bus, 0);
+		}
+	} else if (status & BCM2835_BSC_S_RXR) {
+		if (!bus->remaining)
+			bcm283x_i2c_complete(bus, BCM2835_I2C_REASON_ERROR_DATA);
+		else
+			bcm283x_i2c_drain_fifo(bus);
+	} else if ((status & BCM2835_BSC_S_TA) && bcm283x_i2c_chain_pending(bus)) {
+		/* The pre-loaded write is on the wire, chain the next segment with a repeated start */
+		bcm283x_i2c_next_segment(bus, 0);
+	} else {
+		res = 0;
+	}
+
+	return res;
+
+}
+
+/**
+ * BSC interrupt handler, shared by the two buses.
+ * @param irq_handle The RTDM interrupt handle, its argument is the bus.
+ * @return RTDM_IRQ_HANDLED if the interrupt came from a transfer in progress, RTDM_IRQ_NONE otherwise.
+ */
+static int bcm283x_i2c_irq_handler(rtdm_irq_t *irq_handle) {
+
+	i2c_bcm283x_bus_t *bus = rtdm_irq_get_arg(irq_handle, i2c_bcm283x_bus_t);
+	int res = RTDM_IRQ_NONE;
+
+	rtdm_lock_get(&bus->xfer_lock);
+	if (bus->seg && bcm283x_i2c_service(bus))
+		res = RTDM_IRQ_HANDLED;
+	rtdm_lock_put(&bus->xfer_lock);
+
+	return res;
+
+}
+
+/**
+ * Computes how long a transfer takes on the wire, from the cached byte time.
+ * @param bus The bus.
+ * @param segs The segments of the transfer.
+ * @param nsegs The number of segments.
+ * @return The duration in nanoseconds.
+ */
+static nanosecs_rel_t bcm283x_i2c_xfer_duration(i2c_bcm283x_bus_t *bus, const segment_t *segs, int nsegs) {
+
+	uint64_t bytes = 0;
+	int i;
+
+	/* Every segment carries an address byte */
+	for (i = 0; i < nsegs; i++)
+		bytes += segs[i].len + 1;
+
+	return bytes * bus->i2c.byte_time_ns;
+
+}
+
+/**
+ * Runs a transfer without the BSC interrupt. The caller sleeps through most of the expected duration,
+ * waking up every half FIFO to move the data, and only polls the status for the last
+ * BCM283X_I2C_POLL_TAIL_NS. Past the expected end, it checks once per byte time until the timeout.
+ * A write chained into another segment is pre-loaded in the FIFO, and the status is polled until the
+ * controller goes active to issue the repeated start, which takes a fraction of a byte time.
+ * @param bus The bus.
+ * @param segs The segments of the transfer, in kernel space.
+ * @param nsegs The number of segments, at least one.
+ * @param duration The expected duration of the transfer.
+ * @param timeout How long the transfer may take before it is aborted.
+ * @return The I2C return code on completion, see bcm2835I2CReasonCodes. On failure return -ETIMEDOUT
+ * if the transfer didn't complete in time.
+ */
+static int bcm283x_i2c_xfer_polled(i2c_bcm283x_bus_t *bus, segment_t *segs, int nsegs, nanosecs_rel_t duration, nanosecs_rel_t timeout) {
+
+	rtdm_lockctx_t lock_ctx;
+	nanosecs_abs_t now, end, expiry;
+	nanosecs_rel_t chunk, delay;
+	int done, chain;
+
+	chunk = (BCM2835_BSC_FIFO_SIZE / 2) * (nanosecs_rel_t)bus->i2c.byte_time_ns;
+	now = rtdm_clock_read_monotonic();
+	end = now + duration;
+	expiry = now + timeout;
+
+	rtdm_lock_get_irqsave(&bus->xfer_lock, lock_ctx);
+	bcm283x_i2c_launch(bus, segs, nsegs);
+	chain = bcm283x_i2c_chain_pending(bus);
+	rtdm_lock_put_irqrestore(&bus->xfer_lock, lock_ctx);
+
+	for (;;) {
+
+		if (chain)
+			delay = 0;
+		else if (end > now + BCM283X_I2C_POLL_TAIL_NS)
+			delay = min_t(nanosecs_rel_t, min_t(nanosecs_abs_t, end, expiry) - now - BCM283X_I2C_POLL_TAIL_NS, chunk);
+		else if (now > end)
+			/* Overdue, e.g. the slave stretches the clock: check once per byte time rather than spin */
+			delay = min_t(nanosecs_rel_t, expiry - now, bus->i2c.byte_time_ns);
+		else
+			delay = 0;
+		if (delay > 0)
+			rtdm_task_sleep(delay);
+
+		rtdm_lock_get_irqsave(&bus->xfer_lock, lock_ctx);
+		if (bus->seg)
+			bcm283x_i2c_service(bus);
+		done = !bus->seg;
+		chain = !done && bcm283x_i2c_chain_pending(bus);
+		rtdm_lock_put_irqrestore(&bus->xfer_lock, lock_ctx);
+
+		if (done)
+			return bus->reason;
+
+		now = rtdm_clock_read_monotonic();
+		if (now > expiry)
+			break;
+	}
+
+	/* Abort the transfer */
+	rtdm_lock_get_irqsave(&bus->xfer_lock, lock_ctx);
+	bcm283x_i2c_abort(bus);
+	rtdm_lock_put_irqrestore(&bus->xfer_lock, lock_ctx);
+
+	return -ETIMEDOUT;
+
+}
+
+/**
+ * Accounts the outcome of a transfer in a set of counters.
+ * @param counters The counters.
+ * @param res The outcome of the transfer, an I2C return code or a negative error code.
+ * @param bus_ns The time spent on the bus.
+ */
+static void bcm283x_i2c_count(bcm283x_i2c_counters_t *counters, int res, nanosecs_rel_t bus_ns) {
+
+	counters->transfers++;
+	counters->bus_ns += bus_ns;
+
+	switch (res) {
+		case BCM2835_I2C_REASON_ERROR_NACK:
+			counters->nack++;
+			break;
+		case BCM2835_I2C_REASON_ERROR_CLKT:
+			counters->clkt++;
+			break;
+		case BCM2835_I2C_REASON_ERROR_DATA:
+			counters->data++;
+			break;
+		case BCM2835_I2C_REASON_ERROR_TIMEOUT:
+			counters->overruns++;
+			break;
+		case -ETIMEDOUT:
+			counters->timeouts++;
+			break;
+	}
+
+}
+
+/**
+ * Accounts a transfer in the statistics page of the bus, within a write section of its sequence lock.
+ * @param bus The bus, with its gate lock held.
+ * @param segs The segments of the transfer.
+ * @param nsegs The number of segments.
+ * @param res The outcome of the transfer, an I2C return code or a negative error code.
+ * @param bus_ns The time spent on the bus.
+ */
+static void bcm283x_i2c_account_page(i2c_bcm283x_bus_t *bus, const segment_t *segs, int nsegs, int res, nanosecs_rel_t bus_ns) {
+
+	bcm283x_i2c_stats_page_t *page;
+	int i;
+
+	if (!bus->stats_shm)
+		return;
+	page = bus->stats_shm->va;
+
+	/* The gate lock serializes the writers, readers only need the sequence */
+	WRITE_ONCE(page->seq, page->seq + 1);
+	smp_wmb();
+
+	bcm283x_i2c_count(&page->bus, res, bus_ns);
+	bcm283x_i2c_count(&page->slaves[segs[0].addr % BCM283X_I2C_SLAVES], res, bus_ns);
+	if (res == BCM2835_I2C_REASON_OK) {
+		for (i = 0; i < nsegs; i++) {
+			page->bus.bytes += segs[i].len;
+			page->slaves[segs[i].addr % BCM283X_I2C_SLAVES].bytes += segs[i].len;
+		}
+	}
+
+	smp_wmb();
+	WRITE_ONCE(page->seq, page->seq + 1);
+
+}
+
+/**
+ * Accounts a transfer in the statistics of the bus.
+ * @param bus The bus.
+ * @param segs The segments of the transfer.
+ * @param nsegs The number of segments.
+ * @param res The outcome of the transfer, an I2C return code or a negative error code.
+ * @param bus_ns The time spent on the bus.
+ */
+static void bcm283x_i2c_account(i2c_bcm283x_bus_t *bus, const segment_t *segs, int nsegs, int res, nanosecs_rel_t bus_ns) {
+
+	rtdm_lockctx_t lock_ctx;
+	int i;
+
+	rtdm_lock_get_irqsave(&bus->gate_lock, lock_ctx);
+
+	bcm283x_i2c_account_page(bus, segs, nsegs, res, bus_ns);
+
+	bus->stats.transfers++;
+
+	switch (res) {
+		case BCM2835_I2C_REASON_OK:
+			for (i = 0; i < nsegs; i++)
+				bus->stats.bytes += segs[i].len;
+			break;
+		case BCM2835_I2C_REASON_ERROR_NACK:
+			bus->stats.nack++;
+			break;
+		case BCM2835_I2C_REASON_ERROR_CLKT:
+			bus->stats.clkt++;
+			break;
+		case BCM2835_I2C_REASON_ERROR_DATA:
+			bus->stats.data++;
+			break;
+		case BCM2835_I2C_REASON_ERROR_TIMEOUT:
+			bus->stats.overruns++;
+			break;
+		case -ETIMEDOUT:
+			bus->stats.timeouts++;
+			break;
+	}
+
+	rtdm_lock_put_irqrestore(&bus->gate_lock, lock_ctx);
+
+}
+
+/**
+ * Removes a waiter from the queue of a bus, and lets the next one contend for the bus if it was the head.
+ * @param bus The bus, with its gate lock held.
+ * @param waiter The waiter, queued.
+ */
+static void bcm283x_i2c_dequeue(i2c_bcm283x_bus_t *bus, waiter_t *waiter) {
+
+	int head = (list_first_entry(&bus->waiters, waiter_t, node) == waiter);
+
+	list_del(&waiter->node);
+	if (head && !list_empty(&bus->waiters))
+		rtdm_event_signal(&list_first_entry(&bus->waiters, waiter_t, node)->event);
+
+}
+
+/**
+ * Takes the bus. Ownership is the bus mutex, so the owner inherits the priority of the transaction blocked
+ * on it and can't be held off by tasks of lower priority. Transactions queue by earliest deadline, those
+ * without deadline last in arrival order, and only the head of the queue locks the mutex: the bus is handed
+ * over in deadline order. A head overtaken while it was blocked on the mutex gives it back and queues again.
+ * @param bus The bus.
+ * @param deadline The deadline of the transaction, or BCM283X_I2C_NO_DEADLINE. The wait doesn't go past it.
+ * @return 0 once the caller owns the bus. On failure, -ETIMEDOUT if the deadline passed first, or the
+ * negative error code of the interrupted wait.
+ */
+static int bcm283x_i2c_acquire(i2c_bcm283x_bus_t *bus, nanosecs_abs_t deadline) {
+
+	rtdm_lockctx_t lock_ctx;
+	rtdm_toseq_t timeout_seq;
+	nanosecs_rel_t timeout = RTDM_TIMEOUT_INFINITE;
+	waiter_t waiter, *pos;
+	int res, head;
+
+	/* Past its deadline, a transaction only takes a free bus */
+	if (deadline != BCM283X_I2C_NO_DEADLINE) {
+		timeout = (nanosecs_rel_t)(deadline - rtdm_clock_read_monotonic());
+		if (timeout <= 0)
+			timeout = RTDM_TIMEOUT_NONE;
+	}
+	rtdm_toseq_init(&timeout_seq, timeout);
+
+	waiter.deadline = deadline;
+	rtdm_event_init(&waiter.event, 0);
+
+	/* Queue behind every waiter due no later */
+	rtdm_lock_get_irqsave(&bus->gate_lock, lock_ctx);
+	list_for_each_entry(pos, &bus->waiters, node)
+		if (pos->deadline > deadline)
+			break;
+	list_add_tail(&waiter.node, &pos->node);
+	rtdm_lock_put_irqrestore(&bus->gate_lock, lock_ctx);
+
+	for (;;) {
+
+		rtdm_lock_get_irqsave(&bus->gate_lock, lock_ctx);
+		head = (list_first_entry(&bus->waiters, waiter_t, node) == &waiter);
+		rtdm_lock_put_irqrestore(&bus->gate_lock, lock_ctx);
+
+		if (!head) {
+			res = rtdm_event_timedwait(&waiter.event, timeout, &timeout_seq);
+			if (res)
+				break;
+			continue;
+		}
+
+		res = rtdm_mutex_timedlock(&bus->owner, timeout, &timeout_seq);
+		if (res)
+			break;
+
+		rtdm_lock_get_irqsave(&bus->gate_lock, lock_ctx);
+		head = (list_first_entry(&bus->waiters, waiter_t, node) == &waiter);
+		if (head)
+			bcm283x_i2c_dequeue(bus, &waiter);
+		rtdm_lock_put_irqrestore(&bus->gate_lock, lock_ctx);
+
+		if (head) {
+			rtdm_event_destroy(&waiter.event);
+			return 0;
+		}
+
+		/* Overtaken by an earlier deadline, let the new head through */
+		rtdm_mutex_unlock(&bus->owner);
+	}
+
+	rtdm_lock_get_irqsave(&bus->gate_lock, lock_ctx);
+	bcm283x_i2c_dequeue(bus, &waiter);
+	rtdm_lock_put_irqrestore(&bus->gate_lock, lock_ctx);
+
+	rtdm_event_destroy(&waiter.event);
+
+	return (res == -EWOULDBLOCK) ? -ETIMEDOUT : res;
+
+}
+
+/**
+ * Releases the bus. The head of the queue, blocked on the mutex, takes it over.
+ * @param bus The bus, owned by the caller.
+ */
+static void bcm283x_i2c_release(i2c_bcm283x_bus_t *bus) {
+
+	rtdm_mutex_unlock(&bus->owner);
+
+}
+
+/**
+ * Reports the lateness of a transaction that has a deadline.
+ * @param sched The scheduling of the device instance, whose statistics are updated.
+ * @param deadline The deadline of the transaction.
+ * @param predicted The completion time predicted when the transaction got the bus.
+ * @param end The completion time.
+ */
+static void bcm283x_i2c_report_lateness(sched_t *sched, nanosecs_abs_t deadline, nanosecs_abs_t predicted, nanosecs_abs_t end) {
+
+	bcm283x_i2c_sched_stats_t *stats = &sched->stats;
+	rtdm_lockctx_t lock_ctx;
+
+	rtdm_lock_get_irqsave(&sched->lock, lock_ctx);
+
+	stats->transactions++;
+	stats->last_predicted_lateness_ns = (int64_t)(predicted - deadline);
+	stats->last_lateness_ns = (int64_t)(end - deadline);
+
+	if (stats->last_predicted_lateness_ns > 0)
+		stats->predicted_misses++;
+	if (stats->last_lateness_ns > 0)
+		stats->misses++;
+	if (stats->transactions == 1 || stats->last_lateness_ns > stats->max_lateness_ns)
+		stats->max_lateness_ns = stats->last_lateness_ns;
+
+	rtdm_lock_put_irqrestore(&sched->lock, lock_ctx);
+
+}
+
+/**
+ * Converts a bus speed to a clock divider. An SCL rate gets the smallest even divider that doesn't exceed it.
+ * @param speed The bus speed.
+ * @param clk_hz The rate of the core clock, in Hz.
+ * @return The clock divider, even and at least 2.
+ */
+static uint16_t bcm283x_i2c_divider(const speed_t *speed, unsigned long clk_hz) {
+
+	uint64_t divider;
+
+	if (speed->divider)
+		divider = (clk_hz == BCM2835_CORE_CLK_HZ) ? speed->divider :
+			div_u64((uint64_t)speed->divider * clk_hz, BCM2835_CORE_CLK_HZ);
+	else
+		divider = DIV_ROUND_UP(clk_hz, speed->bus_hz) + 1;
+
+	if (divider > 0xFFFE)
+		return 0xFFFE;
+	if (divider < 2)
+		return 2;
+	return divider & 0xFFFE;
+
+}
+
+/**
+ * Applies a bus speed to a bus with the current rate of the core clock: the clock divider, and data delays
+ * sampling at a quarter of the high period and driving at a sixteenth of the low one, like Linux does.
+ * The registers are only written if the values change.
+ * @param bus The bus, owned by the caller.
+ * @param speed The bus speed.
+ */
+static void bcm283x_i2c_apply_speed(i2c_bcm283x_bus_t *bus, const speed_t *speed) {
+
+	unsigned long clk_hz = READ_ONCE(i2c_bcm283x_clk_hz);
+	uint16_t divider;
+
+	bcm2835_i2c_setCoreClock(&bus->i2c, clk_hz);
+
+	divider = bcm283x_i2c_divider(speed, clk_hz);
+	bcm2835_i2c_setClockDivider(&bus->i2c, divider);
+	bcm2835_i2c_setDataDelay(&bus->i2c, max(divider / 16, 1), max(divider / 4, 1));
+
+}
+
+/**
+ * Counts a duration in a latency histogram of a bus.
+ * @param bus The bus.
+ * @param op The BCM283X_I2C_OP_* type of the operation.
+ * @param hist The BCM283X_I2C_HIST_* measurement.
+ * @param ns The duration, in nanoseconds.
+ */
+static void bcm283x_i2c_hist_record(i2c_bcm283x_bus_t *bus, uint8_t op, int hist, nanosecs_rel_t ns) {
+
+	int bucket = (ns > 0) ? fls64(ns) : 0;
+
+	if (bucket >= BCM283X_I2C_HIST_BUCKETS)
+		bucket = BCM283X_I2C_HIST_BUCKETS - 1;
+
+	atomic_inc(&bus->hist[op][hist][bucket]);
+
+}
+
+/**
+ * Clears the latency histograms of a bus, while transfers may go on.
+ * @param bus The bus.
+ */
+static void bcm283x_i2c_hist_reset(i2c_bcm283x_bus_t *bus) {
+
+	int op, hist, bucket;
+
+	for (op = 0; op < BCM283X_I2C_OPS; op++)
+		for (hist = 0; hist < BCM283X_I2C_HISTS; hist++)
+			for (bucket = 0; bucket < BCM283X_I2C_HIST_BUCKETS; bucket++)
+				atomic_set(&bus->hist[op][hist][bucket], 0);
+
+}
+
+/**
+ * Waits until the rate of the core clock is stable, and marks the bus as relying on it until
+ * bcm283x_i2c_clk_unhold(). A rate change then waits for the transaction to be over.
+ * @param bus The bus, owned by the caller.
+ */
+static void bcm283x_i2c_clk_hold(i2c_bcm283x_bus_t *bus) {
+
+	rtdm_lockctx_t lock_ctx;
+
+	for (;;) {
+		rtdm_lock_get_irqsave(&bus->xfer_lock, lock_ctx);
+		if (!READ_ONCE(i2c_bcm283x_clk_changing)) {
+			bus->clocked = 1;
+			rtdm_lock_put_irqrestore(&bus->xfer_lock, lock_ctx);
+			return;
+		}
+		rtdm_lock_put_irqrestore(&bus->xfer_lock, lock_ctx);
+		rtdm_task_sleep(BCM283X_I2C_CLK_HOLD_NS);
+	}
+
+}
+
+/**
+ * Lets the rate of the core clock change under the bus again.
+ * @param bus The bus, owned by the caller.
+ */
+static void bcm283x_i2c_clk_unhold(i2c_bcm283x_bus_t *bus) {
+
+	rtdm_lockctx_t lock_ctx;
+
+	rtdm_lock_get_irqsave(&bus->xfer_lock, lock_ctx);
+	bus->clocked = 0;
+	rtdm_lock_put_irqrestore(&bus->xfer_lock, lock_ctx);
+
+}
+
+/**
+ * Takes the bus, applies the speed of the request and runs a transfer, waiting for its completion.
+ * Consecutive segments are chained with repeated starts, except after a read which the controller always
+ * closes with a STOP. The caller sleeps while the interrupt handler moves the data through the FIFO.
+ * @param bus The bus.
+ * @param req How to run the transfer.
+ * @param segs The segments of the transfer, in kernel space.
+ * @param nsegs The number of segments, at least one.
+ * @return The I2C return code on completion, see bcm2835I2CReasonCodes. On failure return -ETIMEDOUT
+ * if the transfer didn't complete in time or the deadline passed before the bus was free, or another
+ * negative error code if a wait was interrupted.
+ */
+static int bcm283x_i2c_xfer(i2c_bcm283x_bus_t *bus, const request_t *req, segment_t *segs, int nsegs) {
+
+	rtdm_lockctx_t lock_ctx;
+	nanosecs_rel_t duration, timeout;
+	nanosecs_abs_t submitted, start, end;
+	int res, i, expired = -ETIMEDOUT;
+
+	submitted = rtdm_clock_read_monotonic();
+
+	res = bcm283x_i2c_acquire(bus, req->deadline);
+	if (res)
+		return res;
+
+	/* The previous owner may have left another speed, or the core clock may have changed */
+	bcm283x_i2c_clk_hold(bus);
+	bcm283x_i2c_apply_speed(bus, &req->speed);
+
+	start = rtdm_clock_read_monotonic();
+	bcm283x_i2c_hist_record(bus, req->op, BCM283X_I2C_HIST_WAIT, start - submitted);
+	duration = bcm283x_i2c_xfer_duration(bus, segs, nsegs);
+
+	/* A transfer is lost after twice its duration, or stopped earlier by its budget */
+	timeout = 2 * duration + BCM283X_I2C_TIMEOUT_SLACK_NS;
+	if (req->budget && req->budget < timeout) {
+		timeout = req->budget;
+		expired = BCM2835_I2C_REASON_ERROR_TIMEOUT;
+	}
+
+	bus->ts = req->ts;
+
+	if (!bus->irq) {
+		res = bcm283x_i2c_xfer_polled(bus, segs, nsegs, duration, timeout);
+		goto out;
+	}
+
+	rtdm_event_clear(&bus->done);
+
+	rtdm_lock_get_irqsave(&bus->xfer_lock, lock_ctx);
+	bcm283x_i2c_launch(bus, segs, nsegs);
+	rtdm_lock_put_irqrestore(&bus->xfer_lock, lock_ctx);
+
+	res = rtdm_event_timedwait(&bus->done, timeout, NULL);
+
+	rtdm_lock_get_irqsave(&bus->xfer_lock, lock_ctx);
+	if (bus->seg) {
+		/* Timed out or interrupted, abort the transfer */
+		bcm283x_i2c_abort(bus);
+	} else {
+		res = bus->reason;
+	}
+	rtdm_lock_put_irqrestore(&bus->xfer_lock, lock_ctx);
+
+out:
+	if (res == -ETIMEDOUT)
+		res = expired;
+
+	end = rtdm_clock_read_monotonic();
+	bcm283x_i2c_hist_record(bus, req->op, BCM283X_I2C_HIST_BUS, end - start);
+
+	/* The payload is only copied to the trace buffer when its event is enabled */
+	if (trace_i2c_bcm283x_data_enabled()) {
+		for (i = 0; i < nsegs; i++)
+			if (!(segs[i].flags & SEGMENT_READ) || res == BCM2835_I2C_REASON_OK)
+				trace_i2c_bcm283x_data(BSC_ID(bus), segs[i].addr, segs[i].flags, segs[i].buf, segs[i].len);
+	}
+	trace_i2c_bcm283x_xfer_done(BSC_ID(bus), res, end - start);
+
+	if (req->sched && req->deadline != BCM283X_I2C_NO_DEADLINE)
+		bcm283x_i2c_report_lateness(req->sched, req->deadline, start + duration, end);
+
+	bcm283x_i2c_clk_unhold(bus);
+	bcm283x_i2c_release(bus);
+	bcm283x_i2c_account(bus, segs, nsegs, res, end - start);
+
+	if (res == -ETIMEDOUT)
+		printk(KERN_ERR "%s: Transfer timed out!\r\n", __FUNCTION__);
+
+	return res;
+
+}
+
+/**
+ * Runs a transaction on a bus, and runs it again on the transient errors selected by a retry policy.
+ * The bus is released while backing off.
+ * @param bus The bus.
+ * @param req How to run the transaction.
+ * @param retry The retry policy.
+ * @param segs The segments of the transaction, in kernel space.
+ * @param nsegs The number of segments, at least one.
+ * @return The I2C return code of the last attempt, see bcm2835I2CReasonCodes. On failure, a negative error code.
+ */
+static int bcm283x_i2c_xfer_retry(i2c_bcm283x_bus_t *bus, const request_t *req, const bcm283x_i2c_retry_t *retry, segment_t *segs, int nsegs) {
+
+	nanosecs_rel_t backoff;
+	uint32_t i;
+	int res;
+
+	res = bcm283x_i2c_xfer(bus, req, segs, nsegs);
+
+	backoff = (nanosecs_rel_t)retry->backoff_us * 1000;
+	for (i = 0; i < retry->count && res > 0 && (res & retry->reasons); i++) {
+		if (backoff) {
+			if (req->deadline != BCM283X_I2C_NO_DEADLINE && rtdm_clock_read_monotonic() + backoff > req->deadline)
+				break;
+			if (rtdm_task_sleep(backoff))
+				break;
+			if (retry->flags & BCM283X_I2C_RETRY_EXPONENTIAL)
+				backoff = min_t(nanosecs_rel_t, 2 * backoff, BCM283X_I2C_RETRY_BACKOFF_MAX_US * 1000LL);
+		}
+		res = bcm283x_i2c_xfer(bus, req, segs, nsegs);
+	}
+
+	return res;
+
+}
+
+/**
+ * Runs a transaction of a device instance on its bus, with the configuration of the instance.
+ * Slave addresses are carried by the segments. A one-shot absolute deadline goes to a single
+ * transaction, even when several system calls of the instance run concurrently.
+ * @param context The context associated with the device.
+ * @param op The BCM283X_I2C_OP_* type of the operation, for the histograms.
+ * @param segs The segments of the transaction, in kernel space.
+ * @param nsegs The number of segments, at least one.
+ * @param ts Where to timestamp the transfer, NULL if not needed.
+ * @return The I2C return code on completion, see bcm2835I2CReasonCodes, from the last attempt when the
+ * transaction was retried. On failure, a negative error code.
+ */
+static int bcm283x_i2c_transaction_ts(i2c_bcm283x_context_t *context, uint8_t op, segment_t *segs, int nsegs, timestamps_t *ts) {
+
+	request_t req;
+	nanosecs_rel_t relative_deadline;
+	rtdm_lockctx_t lock_ctx;
+
+	req.ts = ts;
+	req.op = op;
+	req.speed = context->config.speed;
+	req.budget = context->config.budget;
+	req.sched = &context->sched;
+
+	/* A one-shot absolute deadline wins over the relative one, and is consumed along with its read */
+	rtdm_lock_get_irqsave(&context->sched.lock, lock_ctx);
+	req.deadline = context->config.absolute_deadline;
+	context->config.absolute_deadline = BCM283X_I2C_NO_DEADLINE;
+	relative_deadline = context->config.relative_deadline;
+	rtdm_lock_put_irqrestore(&context->sched.lock, lock_ctx);
+
+	if (req.deadline == BCM283X_I2C_NO_DEADLINE && relative_deadline)
+		req.deadline = rtdm_clock_read_monotonic() + relative_deadline;
+
+	return bcm283x_i2c_xfer_retry(context->bus, &req, &context->config.retry, segs, nsegs);
+
+}
+
+/**
+ * Runs a transaction of an IOCTL request on the bus of a device instance, without timestamps, see
+ * bcm283x_i2c_transaction_ts().
+ */
+static int bcm283x_i2c_transaction(i2c_bcm283x_context_t *context, segment_t *segs, int nsegs) {
+
+	return bcm283x_i2c_transaction_ts(context, BCM283X_I2C_OP_IOCTL, segs, nsegs, NULL);
+
+}
+
+/**
+ * Counts the duration of a system call of a device instance in the histograms of its bus.
+ * @param context The context associated with the device.
+ * @param op The BCM283X_I2C_OP_* type of the system call.
+ * @param start When the system call was entered, on the monotonic clock.
+ */
+static void bcm283x_i2c_hist_syscall(i2c_bcm283x_context_t *context, uint8_t op, nanosecs_abs_t start) {
+
+	bcm283x_i2c_hist_record(context->bus, op, BCM283X_I2C_HIST_TOTAL, rtdm_clock_read_monotonic() - start);
+
+}
+
+/**
+ * Samples the System Timer and rtdm_clock_read() together, and updates their correlation. The rate between
+ * both clocks is measured over at least BCM283X_I2C_CLOCK_MAP_PERIOD_US and smoothed, a rate off by more than
+ * 1% (the real-time clock was set) restarts from the nominal rate.
+ */
+static void bcm283x_i2c_clock_sync(void) {
+
+	clock_map_t *map = &i2c_bcm283x_clock_map;
+	rtdm_lockctx_t lock_ctx;
+	nanosecs_abs_t ns;
+	uint64_t st, mult;
+
+	rtdm_lock_get_irqsave(&map->lock, lock_ctx);
+
+	st = bcm2835_st_read();
+	ns = rtdm_clock_read();
+
+	if (map->st && st - map->st < BCM283X_I2C_CLOCK_MAP_PERIOD_US) {
+		rtdm_lock_put_irqrestore(&map->lock, lock_ctx);
+		return;
+	}
+
+	mult = BCM283X_I2C_CLOCK_MAP_MULT;
+	if (map->st && ns > map->ns)
+		mult = div64_u64((ns - map->ns) << 16, st - map->st);
+
+	if (mult < BCM283X_I2C_CLOCK_MAP_MULT - BCM283X_I2C_CLOCK_MAP_MULT / 100
+			|| mult > BCM283X_I2C_CLOCK_MAP_MULT + BCM283X_I2C_CLOCK_MAP_MULT / 100)
+		map->mult = BCM283X_I2C_CLOCK_MAP_MULT;
+	else
+		map->mult = (3 * (uint64_t)map->mult + mult) / 4;
+
+	map->st = st;
+	map->ns = ns;
+
+	rtdm_lock_put_irqrestore(&map->lock, lock_ctx);
+
+}
+
+/**
+ * Converts a System Timer value to rtdm_clock_read().
+ * @param st The System Timer value, in microseconds.
+ * @return The time on rtdm_clock_read(), 0 if st is 0.
+ */
+static int64_t bcm283x_i2c_st_to_ns(uint64_t st) {
+
+	clock_map_t *map = &i2c_bcm283x_clock_map;
+	rtdm_lockctx_t lock_ctx;
+	int64_t ns;
+
+	if (!st)
+		return 0;
+
+	rtdm_lock_get_irqsave(&map->lock, lock_ctx);
+	ns = map->ns + (((int64_t)(st - map->st) * map->mult) >> 16);
+	rtdm_lock_put_irqrestore(&map->lock, lock_ctx);
+
+	return ns;
+
+}
+
+/**
+ * Looks up the BSC interrupt in the device-tree. Both BSC controllers share the same line.
+ * @return The Linux IRQ number, or 0 if none was found.
+ */
+static unsigned int bcm283x_i2c_find_irq(void) {
+
+	struct device_node *dtnode;
+	unsigned int irq;
+
+	dtnode = of_find_compatible_node(NULL, NULL, "brcm,bcm2835-i2c");
+	if (!dtnode)
+		return 0;
+
+	irq = irq_of_parse_and_map(dtnode, 0);
+	of_node_put(dtnode);
+
+	return irq;
+
+}
+
+/**
+ * Called by the clock framework around a change of the rate of the core clock. Before the change, new
+ * transactions are held off and the ones in progress are waited for, so that no transfer runs at a speed
+ * its divider wasn't computed for. The buses reprogram their divider on their next transaction.
+ */
+static int bcm283x_i2c_clk_notify(struct notifier_block *nb, unsigned long event, void *data) {
+
+	struct clk_notifier_data *ndata = data;
+	rtdm_lockctx_t lock_ctx;
+	int i, clocked;
+
+	switch (event) {
+
+		case PRE_RATE_CHANGE:
+			WRITE_ONCE(i2c_bcm283x_clk_changing, 1);
+			for (i = 0; i < i2c_bcm283x_bus_count; i++) {
+				for (;;) {
+					rtdm_lock_get_irqsave(&i2c_bcm283x_buses[i].xfer_lock, lock_ctx);
+					clocked = i2c_bcm283x_buses[i].clocked;
+					rtdm_lock_put_irqrestore(&i2c_bcm283x_buses[i].xfer_lock, lock_ctx);
+					if (!clocked)
+						break;
+					msleep(1);
+				}
+			}
+			break;
+
+		case POST_RATE_CHANGE:
+			WRITE_ONCE(i2c_bcm283x_clk_hz, ndata->new_rate);
+			/* fall through */
+		case ABORT_RATE_CHANGE:
+			smp_wmb();
+			WRITE_ONCE(i2c_bcm283x_clk_changing, 0);
+			break;
+
+	}
+
+	return NOTIFY_OK;
+
+}
+
+static struct notifier_block i2c_bcm283x_clk_nb = {
+	.notifier_call = bcm283x_i2c_clk_notify,
+};
+
+/**
+ * Looks up the core clock of the BSC controllers in the device-tree and follows its rate changes. The rate
+ * defaults to BCM2835_CORE_CLK_HZ if the clock can't be obtained.
+ */
+static void bcm283x_i2c_clk_init(void) {
+
+	struct device_node *dtnode;
+	struct clk *clk;
+	unsigned long rate;
+
+	dtnode = of_find_compatible_node(NULL, NULL, "brcm,bcm2835-i2c");
+	if (!dtnode)
+		goto fallback;
+
+	clk = of_clk_get(dtnode, 0);
+	of_node_put(dtnode);
+	if (IS_ERR(clk))
+		goto fallback;
+
+	rate = clk_get_rate(clk);
+	if (rate)
+		WRITE_ONCE(i2c_bcm283x_clk_hz, rate);
+
+	if (clk_notifier_register(clk, &i2c_bcm283x_clk_nb))
+		printk(KERN_WARNING "%s: Can't follow the rate of the core clock, assuming it stays at %lu Hz.\r\n", __FUNCTION__, rate);
+
+	i2c_bcm283x_clk = clk;
+	return;
+
+fallback:
+	printk(KERN_WARNING "%s: Core clock not found in the device-tree, assuming %d Hz.\r\n", __FUNCTION__, BCM2835_CORE_CLK_HZ);
+
+}
+
+/**
+ * Stops following the rate of the core clock and releases it.
+ */
+static void bcm283x_i2c_clk_cleanup(void) {
+
+	if (!i2c_bcm283x_clk)
+		return;
+
+	clk_notifier_unregister(i2c_bcm283x_clk, &i2c_bcm283x_clk_nb);
+	clk_put(i2c_bcm283x_clk);
+	i2c_bcm283x_clk = NULL;
+
+}
+
+/**
+ * Allocates zeroed pages to be shared with user space. The pages are virtually contiguous only, so
+ * that large pools don't depend on finding a high-order block on a fragmented system.
+ * @param size The size of the area, in bytes.
+ * @return The shared area, with one reference held by the caller, or NULL if out of memory.
+ */
+static shm_t *bcm283x_i2c_shm_alloc(size_t size) {
+
+	shm_t *shm;
+
+	shm = kmalloc(sizeof(shm_t), GFP_KERNEL);
+	if (!shm)
+		return NULL;
+
+	shm->size = PAGE_ALIGN(size);
+	shm->va = vmalloc_user(shm->size);
+	if (!shm->va) {
+		kfree(shm);
+		return NULL;
+	}
+	atomic_set(&shm->refs, 1);
+
+	return shm;
+
+}
+
+/**
+ * Drops a reference to a shared area, and frees it with the last one.
+ * @param shm The shared area.
+ */
+static void bcm283x_i2c_shm_put(shm_t *shm) {
+
+	if (!atomic_dec_and_test(&shm->refs))
+		return;
+
+	vfree(shm->va);
+	kfree(shm);
+
+}
+
+/**
+ * Takes a reference to the shared area of a new mapping, copied from an existing one, and to the module
+ * whose operations it uses.
+ * @param vma The mapping.
+ */
+static void bcm283x_i2c_shm_vma_open(struct vm_area_struct *vma) {
+
+	atomic_inc(&((shm_t *)vma->vm_private_data)->refs);
+	__module_get(THIS_MODULE);
+
+}
+
+/**
+ * Drops the references of a mapping going away.
+ * @param vma The mapping.
+ */
+static void bcm283x_i2c_shm_vma_close(struct vm_area_struct *vma) {
+
+	bcm283x_i2c_shm_put((shm_t *)vma->vm_private_data);
+	module_put(THIS_MODULE);
+
+}
+
+/**
+ * Mapping operations keeping shared areas, and the module, alive while mapped. Mappings outlive close().
+ */
+static const struct vm_operations_struct bcm283x_i2c_shm_vm_ops = {
+	.open = bcm283x_i2c_shm_vma_open,
+	.close = bcm283x_i2c_shm_vma_close
+};
+
+/**
+ * Maps a shared area into user space, with the protection of the mapping.
+ * @param shm The shared area.
+ * @param vma The mapping requested by the user.
+ * @return 0 on success. On failure, a negative error code.
+ */
+static int bcm283x_i2c_shm_mmap(shm_t *shm, struct vm_area_struct *vma) {
+
+	int res;
+
+	if (vma->vm_end - vma->vm_start > shm->size)
+		return -EINVAL;
+
+	/* The mapping calls into the module until unmapped */
+	if (!try_module_get(THIS_MODULE))
+		return -ENODEV;
+
+	/* The offset only selected the area, the mapping starts at its first page */
+	vma->vm_pgoff = 0;
+	res = remap_vmalloc_range(vma, shm->va, 0);
+	if (res) {
+		module_put(THIS_MODULE);
+		return res;
+	}
+
+	vma->vm_private_data = shm;
+	vma->vm_ops = &bcm283x_i2c_shm_vm_ops;
+	atomic_inc(&shm->refs);
+
+	return 0;
+
+}
+
+/**
+ * Initializes the state of a bus, configures its controller and requests its interrupt. Transfers
+ * fall back to polling if the interrupt can't be obtained.
+ * @param bus The bus to initialize.
+ * @param bsc The BSC controller driven by the bus, see bcm2835I2CBus.
+ */
+static void bcm283x_i2c_bus_init(i2c_bcm283x_bus_t *bus, uint8_t bsc) {
+
+	int res;
+
+	/* Configure the controller with arbitrary settings */
+	bcm2835_i2c_begin(&bus->i2c, bsc);
+	bcm2835_i2c_setClockDivider(&bus->i2c, BCM2835_I2C_CLOCK_DIVIDER_626);
+
+	bus->seg = NULL;
+	rtdm_mutex_init(&bus->owner);
+	INIT_LIST_HEAD(&bus->waiters);
+	memset(&bus->stats, 0, sizeof(bus->stats));
+	bus->stats_shm = bcm283x_i2c_shm_alloc(sizeof(bcm283x_i2c_stats_page_t));
+	if (!bus->stats_shm)
+		printk(KERN_WARNING "%s: Can't allocate the statistics page, it won't be available.\r\n", __FUNCTION__);
+	bcm283x_i2c_hist_reset(bus);
+	rtdm_lock_init(&bus->gate_lock);
+	rtdm_lock_init(&bus->xfer_lock);
+	rtdm_event_init(&bus->done, 0);
+
+	/* Make sure no interrupt is enabled before the handler is installed */
+	bcm2835_peri_write(BSC_REG(bus, BCM2835_BSC_C), BCM2835_BSC_C_CLEAR_1);
+
+	bus->irq = bcm283x_i2c_find_irq();
+	if (!bus->irq) {
+		printk(KERN_WARNING "%s: BSC interrupt not found in the device-tree, transfers will be polled.\r\n", __FUNCTION__);
+		return;
+	}
+
+	res = rtdm_irq_request(&bus->irq_handle, bus->irq, bcm283x_i2c_irq_handler, RTDM_IRQTYPE_SHARED, "i2c-bcm283x-rtdm", bus);
+	if (res) {
+		printk(KERN_WARNING "%s: Can't request IRQ %u (%d), transfers will be polled.\r\n", __FUNCTION__, bus->irq, res);
+		bus->irq = 0;
+	}
+
+}
+
+/**
+ * Releases the interrupt, the synchronization objects and the pins of a bus.
+ * @param bus The bus to clean up.
+ */
+static void bcm283x_i2c_bus_cleanup(i2c_bcm283x_bus_t *bus) {
+
+	if (bus->irq)
+		rtdm_irq_free(&bus->irq_handle);
+
+	bcm2835_peri_write(BSC_REG(bus, BCM2835_BSC_C), BCM2835_BSC_C_CLEAR_1);
+
+	rtdm_event_destroy(&bus->done);
+	rtdm_mutex_destroy(&bus->owner);
+
+	/* Mappings still in place keep the page until they go away */
+	if (bus->stats_shm)
+		bcm283x_i2c_shm_put(bus->stats_shm);
+
+	bcm2835_i2c_end(&bus->i2c);
+
+}
+
+/**
+ * Registers the buffer pool of a device instance.
+ * @param fd File descriptor.
+ * @param context The context associated with the device.
+ * @param arg The bcm283x_i2c_pool_setup_t, in user space. Its stride is filled in on return.
+ * @return 0 on success. On failure, a negative error code.
+ */
+static int bcm283x_i2c_pool_setup(struct rtdm_fd *fd, i2c_bcm283x_context_t *context, void __user *arg) {
+
+	bcm283x_i2c_pool_setup_t setup;
+	pool_t *pool;
+	int res;
+
+	res = rtdm_safe_copy_from_user(fd, &setup, arg, sizeof(setup));
+	if (res) {
+		printk(KERN_ERR "%s: Can't retrieve argument from user space (%d)!\r\n", __FUNCTION__, res);
+		return (res < 0) ? res : -res;
+	}
+
+	/* Concurrent setups would each register a pool */
+	mutex_lock(&context->setup_lock);
+
+	if (context->pool) {
+		printk(KERN_ERR "%s: Pool already registered!\r\n", __FUNCTION__);
+		res = -EBUSY;
+		goto out;
+	}
+
+	if (setup.count == 0 || setup.count > BCM283X_I2C_POOL_BUFFERS_MAX || setup.size == 0 || setup.size > BCM283X_I2C_BUFFER_SIZE_MAX) {
+		printk(KERN_ERR "%s: Unexpected value!\r\n", __FUNCTION__);
+		res = -EINVAL;
+		goto out;
+	}
+
+	pool = kmalloc(sizeof(pool_t), GFP_KERNEL);
+	if (!pool) {
+		res = -ENOMEM;
+		goto out;
+	}
+
+	pool->count = setup.count;
+	pool->stride = (setup.size + BCM283X_I2C_POOL_ALIGN - 1) & ~(BCM283X_I2C_POOL_ALIGN - 1);
+	pool->shm = bcm283x_i2c_shm_alloc(pool->count * pool->stride);
+	if (!pool->shm) {
+		kfree(pool);
+		res = -ENOMEM;
+		goto out;
+	}
+
+	setup.stride = pool->stride;
+	res = rtdm_safe_copy_to_user(fd, arg, &setup, sizeof(setup));
+	if (res) {
+		bcm283x_i2c_shm_put(pool->shm);
+		kfree(pool);
+		res = (res < 0) ? res : -res;
+		goto out;
+	}
+
+	/* Publish the pool once initialized, transfers may look it up concurrently */
+	smp_wmb();
+	context->pool = pool;
+
+out:
+	mutex_unlock(&context->setup_lock);
+	return res;
+
+}
+
+/**
+ * Looks up a registered buffer.
+ * @param context The context associated with the device.
+ * @param index The index of the buffer.
+ * @param len The number of bytes the caller is going to access.
+ * @return The buffer, or NULL if there is no such buffer or it is too small.
+ */
+static char *bcm283x_i2c_pool_buffer(i2c_bcm283x_context_t *context, uint32_t index, uint32_t len) {
+
+	pool_t *pool = READ_ONCE(context->pool);
+
+	if (!pool || index >= pool->count || len > pool->stride)
+		return NULL;
+
+	smp_rmb();
+	return (char *)pool->shm->va + index * pool->stride;
+
+}
+
+/**
+ * Releases the buffer pool. Mapped pages live on until unmapped.
+ * @param context The context associated with the device.
+ */
+static void bcm283x_i2c_pool_destroy(i2c_bcm283x_context_t *context) {
+
+	mutex_lock(&context->setup_lock);
+	if (context->pool) {
+		bcm283x_i2c_shm_put(context->pool->shm);
+		kfree(context->pool);
+		context->pool = NULL;
+	}
+	mutex_unlock(&context->setup_lock);
+
+}
+
+/**
+ * Runs one submission entry and fills its completion entry.
+ * @param context The context associated with the device.
+ * @param shared_sqe The submission entry, in the shared ring.
+ * @param cqe The completion entry, in the shared ring.
+ */
+static void bcm283x_i2c_ring_process(i2c_bcm283x_context_t *context, const bcm283x_i2c_sqe_t *shared_sqe, bcm283x_i2c_cqe_t *cqe) {
+
+	ring_t *ring = context->ring;
+	bcm283x_i2c_sqe_t sqe;
+	segment_t segs[2];
+	timestamps_t ts;
+	request_t req;
+	nanosecs_abs_t start;
+	char *wbuf, *rbuf;
+	int nsegs = 0;
+
+	/* Work on a snapshot, user space may rewrite the entry at any time */
+	sqe = *shared_sqe;
+
+	cqe->user_data = sqe.user_data;
+	cqe->rlen = 0;
+	cqe->start = 0;
+	cqe->end = 0;
+
+	if (sqe.addr > 0x7F || (sqe.flags & ~BCM283X_I2C_M_POOL) || (!sqe.wlen && !sqe.rlen)) {
+		cqe->status = -EINVAL;
+		return;
+	}
+
+	if (sqe.flags & BCM283X_I2C_M_POOL) {
+		/* Zero-copy: write from the pool buffer, and read right after the bytes written */
+		wbuf = bcm283x_i2c_pool_buffer(context, sqe.buffer, sqe.wlen + sqe.rlen);
+		rbuf = wbuf + sqe.wlen;
+	} else if (sqe.wlen <= BCM283X_I2C_RING_DATA_MAX && sqe.rlen <= BCM283X_I2C_RING_DATA_MAX) {
+		wbuf = (char *)sqe.data;
+		rbuf = (char *)cqe->data;
+	} else {
+		wbuf = NULL;
+	}
+	if (!wbuf) {
+		cqe->status = -EINVAL;
+		return;
+	}
+
+	if (sqe.wlen) {
+		segs[nsegs].addr = sqe.addr;
+		segs[nsegs].flags = 0;
+		segs[nsegs].len = sqe.wlen;
+		segs[nsegs].buf = wbuf;
+		nsegs++;
+	}
+	if (sqe.rlen) {
+		segs[nsegs].addr = sqe.addr;
+		segs[nsegs].flags = SEGMENT_READ;
+		segs[nsegs].len = sqe.rlen;
+		segs[nsegs].buf = rbuf;
+		nsegs++;
+	}
+
+	/* Left as is if the transfer isn't started */
+	ts.start = 0;
+	ts.done = 0;
+	start = rtdm_clock_read_monotonic();
+
+	/* Run with the config of the ring, the lateness of the instance belongs to its system calls */
+	req.ts = &ts;
+	req.op = BCM283X_I2C_OP_RING;
+	req.speed = ring->speed;
+	req.budget = ring->budget;
+	req.sched = NULL;
+	req.deadline = ring->relative_deadline ? start + ring->relative_deadline : BCM283X_I2C_NO_DEADLINE;
+	cqe->status = bcm283x_i2c_xfer_retry(context->bus, &req, &ring->retry, segs, nsegs);
+	bcm283x_i2c_hist_record(context->bus, BCM283X_I2C_OP_RING, BCM283X_I2C_HIST_TOTAL, rtdm_clock_read_monotonic() - start);
+	cqe->start = ts.start;
+	cqe->end = ts.done;
+
+	if (cqe->status == BCM2835_I2C_REASON_OK)
+		cqe->rlen = sqe.rlen;
+
+}
+
+/**
+ * Poller task: consumes the submission ring and produces the completion ring. It checks for work every
+ * poll_ns, and waits for BCM283X_I2C_RING_WAKEUP once nothing was submitted for idle_ns.
+ * @param arg The context associated with the device.
+ */
+static void bcm283x_i2c_ring_poller(void *arg) {
+
+	i2c_bcm283x_context_t *context = arg;
+	ring_t *ring = context->ring;
+	bcm283x_i2c_ring_t *shared = ring->shm->va;
+	uint32_t mask = ring->entries - 1;
+	nanosecs_abs_t last_work = rtdm_clock_read_monotonic();
+	uint32_t head, cq_tail;
+
+	while (!rtdm_task_should_stop()) {
+
+		head = shared->sq_head;
+		cq_tail = shared->cq_tail;
+
+		if (READ_ONCE(shared->sq_tail) == head) {
+
+			if (rtdm_clock_read_monotonic() - last_work < ring->idle_ns) {
+				rtdm_task_sleep(ring->poll_ns);
+				continue;
+			}
+
+			/* Go idle, unless an entry slipped in before the flag was visible */
+			WRITE_ONCE(shared->flags, shared->flags | BCM283X_I2C_RING_NEED_WAKEUP);
+			smp_mb();
+			if (READ_ONCE(shared->sq_tail) == head)
+				rtdm_event_wait(&ring->wakeup);
+			WRITE_ONCE(shared->flags, shared->flags & ~BCM283X_I2C_RING_NEED_WAKEUP);
+
+			last_work = rtdm_clock_read_monotonic();
+			continue;
+		}
+
+		/* Wait for user space to make room for the completion */
+		if (cq_tail - READ_ONCE(shared->cq_head) >= ring->entries) {
+			rtdm_task_sleep(ring->poll_ns);
+			continue;
+		}
+
+		smp_rmb();
+		bcm283x_i2c_ring_process(context, &BCM283X_I2C_RING_SQES(shared)[head & mask], &BCM283X_I2C_RING_CQES(shared)[cq_tail & mask]);
+		smp_wmb();
+
+		WRITE_ONCE(shared->sq_head, head + 1);
+		WRITE_ONCE(shared->cq_tail, cq_tail + 1);
+
+		last_work = rtdm_clock_read_monotonic();
+	}
+
+}
+
+/**
+ * Sets up the rings of a device instance and starts their poller task.
+ * @param fd File descriptor.
+ * @param context The context associated with the device.
+ * @param arg The bcm283x_i2c_ring_setup_t, in user space.
+ * @return 0 on success. On failure, a negative error code.
+ */
+static int bcm283x_i2c_ring_setup(struct rtdm_fd *fd, i2c_bcm283x_context_t *context, const void __user *arg) {
+
+	bcm283x_i2c_ring_setup_t setup;
+	bcm283x_i2c_ring_t *shared;
+	rtdm_lockctx_t lock_ctx;
+	ring_t *ring;
+	int res;
+
+	res = rtdm_safe_copy_from_user(fd, &setup, arg, sizeof(setup));
+	if (res) {
+		printk(KERN_ERR "%s: Can't retrieve argument from user space (%d)!\r\n", __FUNCTION__, res);
+		return (res < 0) ? res : -res;
+	}
+
+	/* Concurrent setups would each start a poller */
+	mutex_lock(&context->setup_lock);
+
+	if (context->ring) {
+		printk(KERN_ERR "%s: Rings already set up!\r\n", __FUNCTION__);
+		res = -EBUSY;
+		goto out;
+	}
+
+	if (setup.entries == 0 || setup.entries > BCM283X_I2C_RING_ENTRIES_MAX || (setup.entries & (setup.entries - 1))
+			|| setup.priority < RTDM_TASK_LOWEST_PRIORITY || setup.priority > RTDM_TASK_HIGHEST_PRIORITY || setup.poll_ns == 0) {
+		printk(KERN_ERR "%s: Unexpected value!\r\n", __FUNCTION__);
+		res = -EINVAL;
+		goto out;
+	}
+
+	ring = kzalloc(sizeof(ring_t), GFP_KERNEL);
+	if (!ring) {
+		res = -ENOMEM;
+		goto out;
+	}
+
+	ring->entries = setup.entries;
+	ring->poll_ns = setup.poll_ns;
+	ring->idle_ns = setup.idle_ns;
+	ring->speed = context->config.speed;
+	ring->budget = context->config.budget;
+	rtdm_lock_get_irqsave(&context->sched.lock, lock_ctx);
+	ring->relative_deadline = context->config.relative_deadline;
+	rtdm_lock_put_irqrestore(&context->sched.lock, lock_ctx);
+	ring->retry = context->config.retry;
+	ring->shm = bcm283x_i2c_shm_alloc(sizeof(bcm283x_i2c_ring_t) + setup.entries * (sizeof(bcm283x_i2c_sqe_t) + sizeof(bcm283x_i2c_cqe_t)));
+	if (!ring->shm) {
+		kfree(ring);
+		res = -ENOMEM;
+		goto out;
+	}
+
+	shared = ring->shm->va;
+	shared->entries = setup.entries;
+
+	rtdm_event_init(&ring->wakeup, 0);
+	context->ring = ring;
+
+	res = rtdm_task_init(&ring->poller, "i2c-bcm283x-ring", bcm283x_i2c_ring_poller, context, setup.priority, 0);
+	if (res) {
+		printk(KERN_ERR "%s: Can't start the poller task (%d)!\r\n", __FUNCTION__, res);
+		context->ring = NULL;
+		rtdm_event_destroy(&ring->wakeup);
+		bcm283x_i2c_shm_put(ring->shm);
+		kfree(ring);
+	}
+
+out:
+	mutex_unlock(&context->setup_lock);
+	return res;
+
+}
+
+/**
+ * Stops the poller task and releases the rings. Mapped pages live on until unmapped.
+ * @param context The context associated with the device.
+ */
+static void bcm283x_i2c_ring_destroy(i2c_bcm283x_context_t *context) {
+
+	ring_t *ring;
+
+	mutex_lock(&context->setup_lock);
+	ring = context->ring;
+	if (!ring) {
+		mutex_unlock(&context->setup_lock);
+		return;
+	}
+
+	rtdm_task_destroy(&ring->poller);
+	rtdm_event_destroy(&ring->wakeup);
+	bcm283x_i2c_shm_put(ring->shm);
+	kfree(ring);
+	context->ring = NULL;
+	mutex_unlock(&context->setup_lock);
+
+}
+
+/**
+ * Data-ready interrupt handler: timestamps the edge and wakes up the sampler task to run the read.
+ * @param irq_handle The IRQ handle.
+ * @return RTDM_IRQ_HANDLED.
+ */
+static int bcm283x_i2c_drdy_handler(rtdm_irq_t *irq_handle) {
+
+	sampler_t *sampler = rtdm_irq_get_arg(irq_handle, sampler_t);
+
+	sampler->edge = bcm2835_st_read();
+	rtdm_event_signal(&sampler->drdy);
+
+	return RTDM_IRQ_HANDLED;
+
+}
+
+/**
+ * Sampler task: reads the configured registers every period, or on each data-ready edge, and buffers
+ * the samples. The reader is only woken up once the number of samples it waits for is available.
+ * @param arg The sampler.
+ */
+static void bcm283x_i2c_sampler_task(void *arg) {
+
+	sampler_t *sampler = arg;
+	bcm283x_i2c_sample_t *sample;
+	segment_t segs[2];
+	request_t req;
+	uint32_t tail;
+	uint64_t timestamp;
+	nanosecs_abs_t start;
+
+	/* Each read is due by the next period */
+	req.speed = sampler->speed;
+	req.budget = sampler->budget;
+	req.sched = NULL;
+	req.ts = NULL;
+	req.op = BCM283X_I2C_OP_SAMPLER;
+
+	segs[0].addr = sampler->addr;
+	segs[0].flags = 0;
+	segs[0].len = 1;
+	segs[0].buf = &sampler->reg;
+	segs[1].addr = sampler->addr;
+	segs[1].flags = SEGMENT_READ;
+	segs[1].len = sampler->len;
+
+	while (!rtdm_task_should_stop()) {
+
+		if (sampler->drdy_gpio < 0) {
+			rtdm_task_wait_period(NULL);
+			timestamp = bcm2835_st_read();
+		} else {
+			/* Interrupted when the sampler is stopped */
+			if (rtdm_event_wait(&sampler->drdy))
+				continue;
+			timestamp = sampler->edge;
+		}
+
+		tail = sampler->tail;
+
+		/* Drop the sample if the reader lags a whole buffer behind */
+		if (tail - READ_ONCE(sampler->head) >= sampler->entries) {
+			sampler->seq++;
+			continue;
+		}
+
+		sample = &sampler->samples[tail & (sampler->entries - 1)];
+		segs[1].buf = (char *)sample->data;
+		sample->seq = sampler->seq++;
+		sample->timestamp = timestamp;
+		start = rtdm_clock_read_monotonic();
+		req.deadline = start + sampler->period;
+		sample->status = bcm283x_i2c_xfer(sampler->bus, &req, segs, 2);
+		bcm283x_i2c_hist_record(sampler->bus, BCM283X_I2C_OP_SAMPLER, BCM283X_I2C_HIST_TOTAL, rtdm_clock_read_monotonic() - start);
+
+		smp_wmb();
+		WRITE_ONCE(sampler->tail, tail + 1);
+
+		smp_mb();
+		if (tail + 1 - sampler->head >= READ_ONCE(sampler->wanted))
+			rtdm_event_signal(&sampler->ready);
+	}
+
+}
+
+/**
+ * Label of the GPIO controller of the SoC, whose pins are numbered like on the BCM283x.
+ */
+#define BCM283X_I2C_GPIO_LABEL "pinctrl-bcm2835"
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 7, 0)
+/**
+ * Matches the GPIO controller of the SoC.
+ * @param chip The GPIO controller.
+ * @param data Unused.
+ * @return Whether the controller is the one of the SoC.
+ */
+static int bcm283x_i2c_gpio_match(struct gpio_chip *chip, void *data) {
+
+	return chip->label && !strcmp(chip->label, BCM283X_I2C_GPIO_LABEL);
+
+}
+#endif
+
+/**
+ * Translates a GPIO of the SoC into a global GPIO number. The GPIO controller of the SoC doesn't start at 0
+ * on recent kernels, which allocate the bases of the controllers dynamically.
+ * @param pin The GPIO, as numbered on the BCM283x (0 to 53).
+ * @return The global GPIO number. On failure, -ENODEV if the GPIO controller of the SoC isn't there.
+ */
+static int bcm283x_i2c_gpio_number(int pin) {
+
+	int base;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+	struct gpio_device *gdev;
+
+	gdev = gpio_device_find_by_label(BCM283X_I2C_GPIO_LABEL);
+	if (!gdev)
+		return -ENODEV;
+	base = gpio_device_get_base(gdev);
+	gpio_device_put(gdev);
+#else
+	struct gpio_chip *chip;
+
+	chip = gpiochip_find(NULL, bcm283x_i2c_gpio_match);
+	if (!chip)
+		return -ENODEV;
+	base = chip->base;
+#endif
+
+	return base + pin;
+
+}
+
+/**
+ * Sets up the data-ready GPIO of a sampler as an input interrupting on rising edges.
+ * @param sampler The sampler, with its data-ready GPIO set.
+ * @return 0 on success. On failure, a negative error code.
+ */
+static int bcm283x_i2c_drdy_request(sampler_t *sampler) {
+
+	int res;
+
+	res = bcm283x_i2c_gpio_number(sampler->drdy_gpio);
+	if (res < 0) {
+		printk(KERN_ERR "%s: GPIO controller %s not found!\r\n", __FUNCTION__, BCM283X_I2C_GPIO_LABEL);
+		return res;
+	}
+	sampler->drdy_num = res;
+
+	res = gpio_request(sampler->drdy_num, "i2c-bcm283x-drdy");
+	if (res) {
+		printk(KERN_ERR "%s: Can't request GPIO %d (%d)!\r\n", __FUNCTION__, sampler->drdy_gpio, res);
+		return res;
+	}
+
+	res = gpio_direction_input(sampler->drdy_num);
+	if (res)
+		goto fail;
+
+	res = gpio_to_irq(sampler->drdy_num);
+	if (res < 0)
+		goto fail;
+	sampler->drdy_irq = res;
+
+	/* The GPIO interrupt controller arms the rising edge detection (GPREN) and clears the event status (GPEDS) */
+	res = irq_set_irq_type(sampler->drdy_irq, IRQ_TYPE_EDGE_RISING);
+	if (res)
+		goto fail;
+
+	rtdm_event_init(&sampler->drdy, 0);
+	res = rtdm_irq_request(&sampler->drdy_handle, sampler->drdy_irq, bcm283x_i2c_drdy_handler, 0, "i2c-bcm283x-drdy", sampler);
+	if (res) {
+		rtdm_event_destroy(&sampler->drdy);
+		goto fail;
+	}
+
+	return 0;
+
+fail:
+	printk(KERN_ERR "%s: Can't set up the interrupt of GPIO %d (%d)!\r\n", __FUNCTION__, sampler->drdy_gpio, res);
+	gpio_free(sampler->drdy_num);
+	return res;
+
+}
+
+/**
+ * Releases the data-ready GPIO of a sampler, if any. The sampler task must be stopped.
+ * @param sampler The sampler.
+ */
+static void bcm283x_i2c_drdy_free(sampler_t *sampler) {
+
+	if (sampler->drdy_gpio < 0)
+		return;
+
+	rtdm_irq_free(&sampler->drdy_handle);
+	rtdm_event_destroy(&sampler->drdy);
+	gpio_free(sampler->drdy_num);
+
+}
+
+/**
+ * Stops the sampler and releases it. Only on close, once no system call of the instance is in progress.
+ * @param context The context associated with the device.
+ */
+static void bcm283x_i2c_sampler_destroy(i2c_bcm283x_context_t *context) {
+
+	sampler_t *sampler;
+
+	mutex_lock(&context->setup_lock);
+	sampler = context->sampler;
+	if (!sampler) {
+		mutex_unlock(&context->setup_lock);
+		return;
+	}
+
+	if (sampler->running) {
+		rtdm_task_destroy(&sampler->task);
+		bcm283x_i2c_drdy_free(sampler);
+	}
+
+	rtdm_event_destroy(&sampler->ready);
+	rtdm_mutex_destroy(&sampler->read_lock);
+	kfree(sampler->samples);
+	kfree(sampler);
+	context->sampler = NULL;
+	mutex_unlock(&context->setup_lock);
+
+}
+
+/**
+ * Starts the periodic sampler of a device instance. The sampler is allocated on the first start and kept
+ * until close, as readers may still reach it. A restart replaces the buffer, dropping the samples it held.
+ * @param fd File descriptor.
+ * @param context The context associated with the device.
+ * @param arg The bcm283x_i2c_sampler_setup_t, in user space.
+ * @return 0 on success. On failure, a negative error code.
+ */
+static int bcm283x_i2c_sampler_start(struct rtdm_fd *fd, i2c_bcm283x_context_t *context, const void __user *arg) {
+
+	bcm283x_i2c_sampler_setup_t setup;
+	bcm283x_i2c_sample_t *samples, *old = NULL;
+	sampler_t *sampler;
+	int res;
+
+	res = rtdm_safe_copy_from_user(fd, &setup, arg, sizeof(setup));
+	if (res) {
+		printk(KERN_ERR "%s: Can't retrieve argument from user space (%d)!\r\n", __FUNCTION__, res);
+		return (res < 0) ? res : -res;
+	}
+
+	/* Concurrent starts would each set up a sampler */
+	mutex_lock(&context->setup_lock);
+	sampler = context->sampler;
+
+	if (sampler && sampler->running) {
+		printk(KERN_ERR "%s: Sampler already started!\r\n", __FUNCTION__);
+		res = -EBUSY;
+		goto out;
+	}
+
+	if (setup.addr > 0x7F || setup.len == 0 || setup.len > BCM283X_I2C_SAMPLE_DATA_MAX || setup.period_ns < BCM283X_I2C_SAMPLER_PERIOD_MIN
+			|| setup.entries == 0 || setup.entries > BCM283X_I2C_SAMPLER_ENTRIES_MAX || (setup.entries & (setup.entries - 1))
+			|| setup.priority < RTDM_TASK_LOWEST_PRIORITY || setup.priority > RTDM_TASK_HIGHEST_PRIORITY) {
+		printk(KERN_ERR "%s: Unexpected value!\r\n", __FUNCTION__);
+		res = -EINVAL;
+		goto out;
+	}
+
+	samples = kzalloc(setup.entries * sizeof(bcm283x_i2c_sample_t), GFP_KERNEL);
+	if (!samples) {
+		res = -ENOMEM;
+		goto out;
+	}
+
+	if (!sampler) {
+		sampler = kzalloc(sizeof(sampler_t), GFP_KERNEL);
+		if (!sampler) {
+			kfree(samples);
+			res = -ENOMEM;
+			goto out;
+		}
+		rtdm_event_init(&sampler->ready, 0);
+		rtdm_mutex_init(&sampler->read_lock);
+		atomic_set(&sampler->readers, 0);
+	} else {
+		/* Keep new readers out, the ones inside were woken up by the stop and only copy what is left */
+		WRITE_ONCE(sampler->resetting, 1);
+		smp_mb();
+		while (atomic_read(&sampler->readers))
+			msleep(1);
+		old = sampler->samples;
+	}
+
+	sampler->bus = context->bus;
+	sampler->speed = context->config.speed;
+	sampler->budget = context->config.budget;
+	sampler->period = setup.period_ns;
+	sampler->addr = setup.addr;
+	sampler->reg = setup.reg;
+	sampler->len = setup.len;
+	sampler->entries = setup.entries;
+	sampler->samples = samples;
+	sampler->head = 0;
+	sampler->tail = 0;
+	sampler->seq = 0;
+	sampler->wanted = 1;
+	sampler->drdy_gpio = context->config.drdy_gpio;
+	rtdm_event_clear(&sampler->ready);
+	kfree(old);
+
+	/* Readers only see the sampler once set up */
+	if (context->sampler) {
+		smp_wmb();
+		WRITE_ONCE(sampler->resetting, 0);
+	} else
+		smp_store_release(&context->sampler, sampler);
+
+	/* On failure, the sampler is left stopped */
+	if (sampler->drdy_gpio >= 0) {
+		res = bcm283x_i2c_drdy_request(sampler);
+		if (res)
+			goto out;
+	}
+
+	/* The task only runs periodically without data-ready line */
+	res = rtdm_task_init(&sampler->task, "i2c-bcm283x-sampler", bcm283x_i2c_sampler_task, sampler, setup.priority,
+			(sampler->drdy_gpio < 0) ? setup.period_ns : 0);
+	if (res) {
+		printk(KERN_ERR "%s: Can't start the sampler task (%d)!\r\n", __FUNCTION__, res);
+		bcm283x_i2c_drdy_free(sampler);
+		goto out;
+	}
+
+	sampler->running = 1;
+
+out:
+	mutex_unlock(&context->setup_lock);
+	return res;
+
+}
+
+/**
+ * Stops the sampler task, and wakes up the reader so that it gets the samples left.
+ * @param context The context associated with the device.
+ * @return 0 on success, -ENODEV if the sampler isn't running.
+ */
+static int bcm283x_i2c_sampler_stop(i2c_bcm283x_context_t *context) {
+
+	sampler_t *sampler;
+
+	mutex_lock(&context->setup_lock);
+	sampler = context->sampler;
+
+	if (!sampler || !sampler->running) {
+		mutex_unlock(&context->setup_lock);
+		return -ENODEV;
+	}
+
+	rtdm_task_destroy(&sampler->task);
+	bcm283x_i2c_drdy_free(sampler);
+	sampler->running = 0;
+	rtdm_event_signal(&sampler->ready);
+	mutex_unlock(&context->setup_lock);
+
+	return 0;
+
+}
+
+/**
+ * Changes the data-ready line of the sampler, used from its next start.
+ * @param fd File descriptor.
+ * @param context The context associated with the device.
+ * @param arg The BCM GPIO number of the line or -1, an int in user space.
+ * @return 0 on success, -EBUSY while the sampler runs. On failure, another negative error code.
+ */
+static int bcm283x_i2c_set_drdy(struct rtdm_fd *fd, i2c_bcm283x_context_t *context, const void __user *arg) {
+
+	int gpio, res;
+
+	res = rtdm_safe_copy_from_user(fd, &gpio, arg, sizeof(int));
+	if (res) {
+		printk(KERN_ERR "%s: Can't retrieve argument from user space (%d)!\r\n", __FUNCTION__, res);
+		return (res < 0) ? res : -res;
+	}
+
+	if (gpio < -1 || gpio > 53) {
+		printk(KERN_ERR "%s: Unexpected value!\r\n", __FUNCTION__);
+		return -EINVAL;
+	}
+
+	/* A concurrent start reads the line */
+	mutex_lock(&context->setup_lock);
+	if (context->sampler && context->sampler->running) {
+		res = -EBUSY;
+	} else {
+		context->config.drdy_gpio = gpio;
+		res = 0;
+	}
+	mutex_unlock(&context->setup_lock);
+
+	return res;
+
+}
+
+/**
+ * Reads a batch of samples, waiting until the requested number is available while the sampler runs.
+ * @param fd File descriptor.
+ * @param context The context associated with the device.
+ * @param arg The bcm283x_i2c_sampler_read_t, in user space.
+ * @return The number of samples read. On failure, a negative error code.
+ */
+static int bcm283x_i2c_sampler_read(struct rtdm_fd *fd, i2c_bcm283x_context_t *context, const void __user *arg) {
+
+	sampler_t *sampler = smp_load_acquire(&context->sampler);
+	bcm283x_i2c_sampler_read_t request;
+	rtdm_toseq_t timeout_seq;
+	uint32_t head, tail, count, first;
+	int res;
+
+	if (!sampler)
+		return -ENODEV;
+
+	res = rtdm_safe_copy_from_user(fd, &request, arg, sizeof(request));
+	if (res) {
+		printk(KERN_ERR "%s: Can't retrieve argument from user space (%d)!\r\n", __FUNCTION__, res);
+		return (res < 0) ? res : -res;
+	}
+
+	if (request.count == 0 || request.min > request.count) {
+		printk(KERN_ERR "%s: Unexpected value!\r\n", __FUNCTION__);
+		return -EINVAL;
+	}
+
+	/* A restart waits for the readers inside before replacing the buffer */
+	atomic_inc(&sampler->readers);
+	smp_mb__after_atomic();
+	if (READ_ONCE(sampler->resetting)) {
+		atomic_dec(&sampler->readers);
+		return -EAGAIN;
+	}
+
+	rtdm_toseq_init(&timeout_seq, request.timeout_ns);
+	rtdm_mutex_lock(&sampler->read_lock);
+
+	/* Wait for the batch, the task only signals once enough samples are there */
+	head = sampler->head;
+	WRITE_ONCE(sampler->wanted, request.min);
+	smp_mb();
+	while (sampler->running && READ_ONCE(sampler->tail) - head < request.min) {
+		res = rtdm_event_timedwait(&sampler->ready, request.timeout_ns, &timeout_seq);
+		if (res)
+			break;
+	}
+	WRITE_ONCE(sampler->wanted, 1);
+
+	/* Copy what is available, in at most two chunks as the buffer wraps around */
+	tail = READ_ONCE(sampler->tail);
+	smp_rmb();
+	count = tail - head;
+	if (count > request.count)
+		count = request.count;
+
+	first = sampler->entries - (head & (sampler->entries - 1));
+	if (first > count)
+		first = count;
+
+	res = rtdm_safe_copy_to_user(fd, request.samples, &sampler->samples[head & (sampler->entries - 1)], first * sizeof(bcm283x_i2c_sample_t));
+	if (!res && count > first)
+		res = rtdm_safe_copy_to_user(fd, request.samples + first, sampler->samples, (count - first) * sizeof(bcm283x_i2c_sample_t));
+
+	if (!res) {
+		smp_mb();
+		WRITE_ONCE(sampler->head, head + count);
+	}
+
+	rtdm_mutex_unlock(&sampler->read_lock);
+	smp_mb__before_atomic();
+	atomic_dec(&sampler->readers);
+
+	if (res) {
+		printk(KERN_ERR "%s: Can't copy samples from driver to user space (%d)!\r\n", __FUNCTION__, res);
+		return (res < 0) ? res : -res;
+	}
+
+	return count;
+
+}
+
+/**
+ * Open handler. Note: opening a named device instance always happens from secondary mode.
+ * @param[in] fd File descriptor associated with opened device instance.
+ * @param[in] oflags Open flags as passed by the user.
+ * @return 0 on success. On failure, a negative error code is returned.
+ */
+static int bcm283x_i2c_rtdm_open(struct rtdm_fd *fd, int oflags) {
+
+	i2c_bcm283x_context_t *context;
+
+	/* Retrieve context */
+	context = (i2c_bcm283x_context_t *) rtdm_fd_to_private(fd);
+
+	/* Each device drives the BSC controller of its minor */
+	context->bus = &i2c_bcm283x_buses[rtdm_fd_minor(fd)];
+
+	/* Set default clock config */
+	context->config.clock_divider = BCM2835_I2C_CLOCK_DIVIDER_626;
+	context->config.speed.bus_hz = 0;
+	context->config.speed.divider = BCM2835_I2C_CLOCK_DIVIDER_626;
+
+	/* Transactions have no deadline until requested */
+	context->config.relative_deadline = 0;
+	context->config.absolute_deadline = BCM283X_I2C_NO_DEADLINE;
+	context->config.budget = 0;
+	rtdm_lock_init(&context->sched.lock);
+	memset(&context->sched.stats, 0, sizeof(context->sched.stats));
+
+	/* Errors go to the caller until a retry policy is set */
+	memset(&context->config.retry, 0, sizeof(context->config.retry));
+
+	/* Data is not checked nor registers cached until requested */
+	context->crc.mode = BCM283X_I2C_CRC_NONE;
+	context->regmap.enabled = 0;
+
+	/* The sampler is periodic until a data-ready line is given */
+	context->config.drdy_gpio = -1;
+	
+	/* Set flags */
+	context->config.flags = oflags;
+
+	/* No rings, buffer pool nor sampler until requested */
+	context->ring = NULL;
+	context->pool = NULL;
+	context->sampler = NULL;
+	mutex_init(&context->setup_lock);
+	rtdm_mutex_init(&context->data_lock);
+	
+	return 0;
+
+}
+
+/**
+ * Close handler. Note: closing a device instance always happens from secondary mode.
+ * @param[in] fd File descriptor associated with opened device instance.
+ * @return 0 on success. On failure return a negative error code.
+ */
+static void bcm283x_i2c_rtdm_close(struct rtdm_fd *fd) {
+
+	i2c_bcm283x_context_t *context;
+
+	/* Retrieve context */
+	context = (i2c_bcm283x_context_t *) rtdm_fd_to_private(fd);
+
+	/* Stop the sampler and the ring poller, then release the buffers the latter may use */
+	bcm283x_i2c_sampler_destroy(context);
+	bcm283x_i2c_ring_destroy(context);
+	bcm283x_i2c_pool_destroy(context);
+	mutex_destroy(&context->setup_lock);
+	rtdm_mutex_destroy(&context->data_lock);
+
+}
+
+/**
+ * Mmap handler. Note: mapping always happens from secondary mode.
+ * @param[in] fd File descriptor.
+ * @param[in] vma The mapping requested by the user, its offset selects the area (BCM283X_I2C_MMAP_*).
+ * @return 0 on success. On failure, a negative error code.
+ */
+static int bcm283x_i2c_rtdm_mmap(struct rtdm_fd *fd, struct vm_area_struct *vma) {
+
+	i2c_bcm283x_context_t *context;
+
+	/* Retrieve context */
+	context = (i2c_bcm283x_context_t *) rtdm_fd_to_private(fd);
+
+	switch (vma->vm_pgoff << PAGE_SHIFT) {
+
+		case BCM283X_I2C_MMAP_RING:
+			if (!context->ring)
+				return -ENODEV;
+			return bcm283x_i2c_shm_mmap(context->ring->shm, vma);
+
+		case BCM283X_I2C_MMAP_POOL:
+			if (!context->pool)
+				return -ENODEV;
+			return bcm283x_i2c_shm_mmap(context->pool->shm, vma);
+
+		case BCM283X_I2C_MMAP_STATS:
+			if (!context->bus->stats_shm)
+				return -ENODEV;
+			/* Only the driver writes the counters, and the mapping can't be made writable later. The pages
+			 * are inserted with the protection of the mapping, read-only without VM_WRITE */
+			if (vma->vm_flags & VM_WRITE)
+				return -EPERM;
+			vm_flags_clear(vma, VM_MAYWRITE);
+			return bcm283x_i2c_shm_mmap(context->bus->stats_shm, vma);
+
+		default:
+			return -EINVAL;
+
+	}
+
+}
+
+/**
+ * Computes the CRC-8 of a buffer, one table lookup per byte.
+ * @param crc The CRC configuration.
+ * @param value The CRC of the preceding bytes, or the initial value.
+ * @param buf The buffer.
+ * @param len The length of the buffer.
+ * @return The CRC.
+ */
+static uint8_t bcm283x_i2c_crc8(const crc_t *crc, uint8_t value, const char *buf, size_t len) {
+
+	while (len--)
+		value = crc->table[value ^ (uint8_t)*buf++];
+
+	return value;
+
+}
+
+/**
+ * Computes the SMBus PEC of a transaction, over the address byte and the data of each segment.
+ * @param crc The CRC configuration.
+ * @param segs The segments of the transaction.
+ * @param nsegs The number of segments.
+ * @return The PEC.
+ */
+static uint8_t bcm283x_i2c_pec(const crc_t *crc, const segment_t *segs, int nsegs) {
+
+	uint8_t value = 0;
+	int i;
+
+	for (i = 0; i < nsegs; i++) {
+		value = crc->table[value ^ (uint8_t)((segs[i].addr << 1) | ((segs[i].flags & SEGMENT_READ) ? 1 : 0))];
+		value = bcm283x_i2c_crc8(crc, value, segs[i].buf, segs[i].len);
+	}
+
+	return value;
+
+}
+
+/**
+ * Computes the length of data once its CRCs are inserted.
+ * @param crc The CRC configuration.
+ * @param len The length of the data.
+ * @return The length on the bus, or -EINVAL if the data isn't made of whole words.
+ */
+static int bcm283x_i2c_crc_len(const crc_t *crc, size_t len) {
+
+	switch (crc->mode) {
+		case BCM283X_I2C_CRC_PEC:
+			return len + 1;
+
+		case BCM283X_I2C_CRC_WORD:
+			if (len % crc->word_len) {
+				printk(KERN_ERR "%s: Data isn't made of %u-byte words!\r\n", __FUNCTION__, crc->word_len);
+				return -EINVAL;
+			}
+			return len + len / crc->word_len;
+	}
+
+	return len;
+
+}
+
+/**
+ * Computes the largest length of data that fits in a buffer along with its CRCs.
+ * @param crc The CRC configuration.
+ * @param size The size of the buffer.
+ * @return The length of the data.
+ */
+static size_t bcm283x_i2c_crc_room(const crc_t *crc, size_t size) {
+
+	switch (crc->mode) {
+		case BCM283X_I2C_CRC_PEC:
+			return size - 1;
+
+		case BCM283X_I2C_CRC_WORD:
+			return size / (crc->word_len + 1) * crc->word_len;
+	}
+
+	return size;
+
+}
+
+/**
+ * Inserts the CRCs in the data of the last segment of a transaction, which is written.
+ * @param crc The CRC configuration.
+ * @param segs The segments of the transaction.
+ * @param nsegs The number of segments.
+ * @param size The size of the buffer of the last segment.
+ * @return 0 on success, -EINVAL if the data doesn't fit in the buffer with its CRCs.
+ */
+static int bcm283x_i2c_crc_encode(const crc_t *crc, segment_t *segs, int nsegs, size_t size) {
+
+	segment_t *seg = &segs[nsegs - 1];
+	char *src, *dst;
+	int len;
+
+	len = bcm283x_i2c_crc_len(crc, seg->len);
+	if (len < 0)
+		return len;
+	if (len > size) {
+		printk(KERN_ERR "%s: No room for the CRC!\r\n", __FUNCTION__);
+		return -EINVAL;
+	}
+
+	switch (crc->mode) {
+		case BCM283X_I2C_CRC_PEC:
+			seg->buf[seg->len] = bcm283x_i2c_pec(crc, segs, nsegs);
+			break;
+
+		case BCM283X_I2C_CRC_WORD:
+			/* Spread the words from the last one, so that none is overwritten before it is moved */
+			src = seg->buf + seg->len;
+			dst = seg->buf + len;
+			while (src > seg->buf) {
+				src -= crc->word_len;
+				dst -= crc->word_len + 1;
+				dst[crc->word_len] = bcm283x_i2c_crc8(crc, crc->init, src, crc->word_len);
+				memmove(dst, src, crc->word_len);
+			}
+			break;
+	}
+
+	seg->len = len;
+	return 0;
+
+}
+
+/**
+ * Checks the CRCs in the data of the last segment of a transaction, which is read, and strips them in place.
+ * A CRC computed over the data followed by its CRC is 0 if they match.
+ * @param crc The CRC configuration.
+ * @param segs The segments of the transaction.
+ * @param nsegs The number of segments.
+ * @return 0 on success, -EBADMSG if a CRC doesn't match.
+ */
+static int bcm283x_i2c_crc_decode(const crc_t *crc, segment_t *segs, int nsegs) {
+
+	segment_t *seg = &segs[nsegs - 1];
+	char *src, *dst, *end;
+
+	switch (crc->mode) {
+		case BCM283X_I2C_CRC_PEC:
+			if (bcm283x_i2c_pec(crc, segs, nsegs))
+				return -EBADMSG;
+			seg->len--;
+			break;
+
+		case BCM283X_I2C_CRC_WORD:
+			end = seg->buf + seg->len;
+			for (src = dst = seg->buf; src < end; src += crc->word_len + 1, dst += crc->word_len) {
+				if (bcm283x_i2c_crc8(crc, crc->init, src, crc->word_len + 1))
+					return -EBADMSG;
+				memmove(dst, src, crc->word_len);
+			}
+			seg->len = dst - seg->buf;
+			break;
+	}
+
+	return 0;
+
+}
+
+/**
+ * Converts an I2C return code to an error code, for the calls that return a number of bytes.
+ * @param reason The I2C return code of a failed transfer, see bcm2835I2CReasonCodes.
+ * @return -ENXIO on NACK, -EREMOTEIO on clock stretch timeout, -ETIME when the budget ran out, -EIO otherwise.
+ */
+static int bcm283x_i2c_reason_errno(int reason) {
+
+	switch (reason) {
+		case BCM2835_I2C_REASON_ERROR_NACK:
+			return -ENXIO;
+		case BCM2835_I2C_REASON_ERROR_CLKT:
+			return -EREMOTEIO;
+		case BCM2835_I2C_REASON_ERROR_TIMEOUT:
+			return -ETIME;
+		default:
+			return -EIO;
+	}
+
+}
+
+/**
+ * Reads from the slave of a device instance into the receive buffer. If the bit [0] of flags is activated
+ * repeated start is enabled.
+ * @param context The context associated with the device.
+ * @param size Number of bytes to read.
+ * @param ts Where to timestamp the transfer, NULL if not needed.
+ * @return On success, the number of bytes read, available in the receive buffer. On failure, a negative error code,
+ * see bcm283x_i2c_reason_errno() for the errors of the bus.
+ */
+static ssize_t bcm283x_i2c_read(i2c_bcm283x_context_t *context, size_t size, timestamps_t *ts) {
+
+	segment_t segs[2];
+	size_t max;
+	int res = 0, len, nsegs = 0;
+
+	/* Limit size, leaving room for the CRCs */
+	max = bcm283x_i2c_crc_room(&context->crc, BCM283X_I2C_BUFFER_SIZE_MAX);
+	context->receive_buffer.size = (size > max) ? max : size;
+	len = bcm283x_i2c_crc_len(&context->crc, context->receive_buffer.size);
+	if (len < 0)
+		return len;
+
+	/* Select between normal read or with repeated start */
+	if(!(context->config.flags&1)){
+		segs[0].addr = context->config.slave_address;
+		segs[0].flags = SEGMENT_READ;
+		segs[0].len = len;
+		segs[0].buf = context->receive_buffer.data;
+		nsegs = 1;
+	}else if(context->config.register_address > 0){
+		segs[0].addr = context->config.slave_address;
+		segs[0].flags = 0;
+		segs[0].len = 1;
+		segs[0].buf = &context->config.register_address;
+		segs[1].addr = context->config.slave_address;
+		segs[1].flags = SEGMENT_READ;
+		segs[1].len = len;
+		segs[1].buf = context->receive_buffer.data;
+		nsegs = 2;
+	}
+	if (nsegs) {
+		res = bcm283x_i2c_transaction_ts(context, BCM283X_I2C_OP_READ, segs, nsegs, ts);
+		if (res < 0)
+			return res;
+		if (res != BCM2835_I2C_REASON_OK)
+			return bcm283x_i2c_reason_errno(res);
+
+		/* Reject corrupt data before it reaches user space */
+		len = bcm283x_i2c_crc_decode(&context->crc, segs, nsegs);
+		if (len < 0)
+			return len;
+	}
+
+	return (ssize_t)context->receive_buffer.size;
+
+}
+
+/**
+ * Read from the device. If the bit [0] of flags is activated repeated start is enabled.
+ * @param[in] fd File descriptor.
+ * @param[out] buf Input buffer as passed by the user.
+ * @param[in] size Number of bytes the user requests to read.
+ * @return On success, the number of bytes read. On failure return either -ENOSYS, to request that this handler be called again from the opposite realtime/non-realtime context, or another negative error code.
+ */
+static ssize_t bcm283x_i2c_rtdm_read_rt(struct rtdm_fd *fd, void __user *buf, size_t size) {
+
+	i2c_bcm283x_context_t *context;
+	nanosecs_abs_t start;
+	ssize_t len;
+	int res;
+
+	/* Retrieve context */
+	context = (i2c_bcm283x_context_t *) rtdm_fd_to_private(fd);
+	start = rtdm_clock_read_monotonic();
+
+	/* The receive buffer is held until copied out */
+	res = rtdm_mutex_lock(&context->data_lock);
+	if (res)
+		return res;
+
+	len = bcm283x_i2c_read(context, size, NULL);
+	if (len < 0) {
+		rtdm_mutex_unlock(&context->data_lock);
+		/* Failed reads are the tail of the histogram, count them too */
+		bcm283x_i2c_hist_syscall(context, BCM283X_I2C_OP_READ, start);
+		return len;
+	}
+
+	/* Copy data to user space */
+	res = rtdm_safe_copy_to_user(fd, buf, (const void *)context->receive_buffer.data, len);
+	rtdm_mutex_unlock(&context->data_lock);
+	bcm283x_i2c_hist_syscall(context, BCM283X_I2C_OP_READ, start);
+	if (res) {
+		printk(KERN_ERR "%s: Can't copy data from driver to user space (%d)!\r\n", __FUNCTION__, res);
+		return (res < 0) ? res : -res;
+	}
+
+	/* Return read bytes */
+	return len;
+
+}
+
+/**
+ * Reads from the device like bcm283x_i2c_rtdm_read_rt() does, and returns the timestamps of the transfer.
+ * @param fd File descriptor.
+ * @param context The context associated with the device.
+ * @param arg The bcm283x_i2c_read_ts_t, in user space.
+ * @return On success, the number of bytes read. On failure, a negative error code.
+ */
+static int bcm283x_i2c_read_ts(struct rtdm_fd *fd, i2c_bcm283x_context_t *context, void __user *arg) {
+
+	bcm283x_i2c_read_ts_t request;
+	timestamps_t ts;
+	ssize_t len;
+	int res;
+
+	res = rtdm_safe_copy_from_user(fd, &request, arg, sizeof(request));
+	if (res) {
+		printk(KERN_ERR "%s: Can't retrieve argument from user space (%d)!\r\n", __FUNCTION__, res);
+		return (res < 0) ? res : -res;
+	}
+
+	/* Left as is if the transfer isn't started */
+	memset(&ts, 0, sizeof(ts));
+
+	len = bcm283x_i2c_read(context, request.size, &ts);
+	if (len < 0)
+		return len;
+
+	res = rtdm_safe_copy_to_user(fd, request.buf, context->receive_buffer.data, len);
+	if (res) {
+		printk(KERN_ERR "%s: Can't copy data from driver to user space (%d)!\r\n", __FUNCTION__, res);
+		return (res < 0) ? res : -res;
+	}
+
+	bcm283x_i2c_clock_sync();
+	request.ts.start_us = ts.start;
+	request.ts.first_us = ts.first;
+	request.ts.done_us = ts.done;
+	request.ts.start_ns = bcm283x_i2c_st_to_ns(ts.start);
+	request.ts.first_ns = bcm283x_i2c_st_to_ns(ts.first);
+	request.ts.done_ns = bcm283x_i2c_st_to_ns(ts.done);
+
+	res = rtdm_safe_copy_to_user(fd, arg, &request, sizeof(request));
+	if (res) {
+		printk(KERN_ERR "%s: Can't copy timestamps from driver to user space (%d)!\r\n", __FUNCTION__, res);
+		return (res < 0) ? res : -res;
+	}
+
+	return len;
+
+}
+
+/**
+ * Writes to the slave of a device instance. If the bit [1] of flags is activated, the commands are written
+ * instead and the data is read back after a repeated start.
+ * @param fd File descriptor.
+ * @param context The context associated with the device.
+ * @param buf Output buffer as passed by the user.
+ * @param size Number of bytes the user requests to write.
+ * @return On success, the I2C return code. On failure, a negative error code.
+ */
+static int bcm283x_i2c_write(struct rtdm_fd *fd, i2c_bcm283x_context_t *context, const void __user *buf, size_t size) {
+
+	segment_t segs[2];
+	int res, len;
+	
+	/* Ensure that there will be enough space in the buffer */
+	if (size > BCM283X_I2C_BUFFER_SIZE_MAX) {
+		printk(KERN_ERR "%s: Trying to transmit data larger than buffer size !", __FUNCTION__);
+		return -EINVAL;
+	}
+	
+	context->transmit_buffer.size = size;
+	
+	/* Save data in kernel space buffer */
+	res = rtdm_safe_copy_from_user(fd, (void *)context->transmit_buffer.data, (const void *)buf, context->transmit_buffer.size);
+	if (res) {
+		printk(KERN_ERR "%s: Can't copy data from user space to driver (%d)!\r\n", __FUNCTION__, res);
+		return (res < 0) ? res : -res;
+	}
+
+	/* Select between normal write or with repeated start */
+	if(!(context->config.flags&2)){
+		segs[0].addr = context->config.slave_address;
+		segs[0].flags = 0;
+		segs[0].len = context->transmit_buffer.size;
+		segs[0].buf = context->transmit_buffer.data;
+		res = bcm283x_i2c_crc_encode(&context->crc, segs, 1, BCM283X_I2C_BUFFER_SIZE_MAX);
+		if (res < 0)
+			return res;
+		res = bcm283x_i2c_transaction_ts(context, BCM283X_I2C_OP_WRITE, segs, 1, NULL);
+		if (res < 0)
+			return res;
+
+	}else if(context->config.cmds_size > 0){
+
+		len = bcm283x_i2c_crc_len(&context->crc, context->transmit_buffer.size);
+		if (len < 0)
+			return len;
+		if (len > BCM283X_I2C_BUFFER_SIZE_MAX) {
+			printk(KERN_ERR "%s: No room for the CRC!\r\n", __FUNCTION__);
+			return -EINVAL;
+		}
+	
+		/* The receive buffer is unused during a write, hold the commands in it */
+		res = rtdm_safe_copy_from_user(fd, (void *)context->receive_buffer.data, (const void *)context->config.cmds, context->config.cmds_size);
+		if (res) {
+			printk(KERN_ERR "%s: Can't copy commands from user space to driver (%d)!\r\n", __FUNCTION__, res);
+			return (res < 0) ? res : -res;
+		}
+
+		segs[0].addr = context->config.slave_address;
+		segs[0].flags = 0;
+		segs[0].len = context->config.cmds_size;
+		segs[0].buf = context->receive_buffer.data;
+		segs[1].addr = context->config.slave_address;
+		segs[1].flags = SEGMENT_READ;
+		segs[1].len = len;
+		segs[1].buf = context->transmit_buffer.data;
+		res = bcm283x_i2c_transaction_ts(context, BCM283X_I2C_OP_WRITE, segs, 2, NULL);
+		if (res != BCM2835_I2C_REASON_OK)
+			return res;
+
+		/* Reject corrupt data before it reaches user space */
+		len = bcm283x_i2c_crc_decode(&context->crc, segs, 2);
+		if (len < 0)
+			return len;
+
+		/* Copy data to user space, keeping the I2C return code */
+		len = rtdm_safe_copy_to_user(fd, (void *)context->config.cmds, (const void *)context->transmit_buffer.data, context->transmit_buffer.size);
+		if (len) {
+			printk(KERN_ERR "%s: Can't copy data from driver to user space (%d)!\r\n", __FUNCTION__, len);
+			return (len < 0) ? len : -len;
+		}
+	}
+		
+	
+	/* Return bytes written */
+	return res;
+}
+
+/**
+ * Write to the device.
+ * @param[in] fd File descriptor.
+ * @param[in,out] buf Output buffer as passed by the user.
+ * @param[in] size Number of bytes the user requests to write.
+ * @return On success, the I2C return code. On failure return either -ENOSYS, to request that this handler be called again from the opposite realtime/non-realtime context, or another negative error code.
+ */
+static int bcm283x_i2c_rtdm_write_rt(struct rtdm_fd *fd, const void __user *buf, size_t size) {
+
+	i2c_bcm283x_context_t *context;
+	nanosecs_abs_t start;
+	int res;
+
+	/* Retrieve context */
+	context = (i2c_bcm283x_context_t *) rtdm_fd_to_private(fd);
+	start = rtdm_clock_read_monotonic();
+
+	res = rtdm_mutex_lock(&context->data_lock);
+	if (res)
+		return res;
+	res = bcm283x_i2c_write(fd, context, buf, size);
+	rtdm_mutex_unlock(&context->data_lock);
+	bcm283x_i2c_hist_syscall(context, BCM283X_I2C_OP_WRITE, start);
+
+	return res;
+}
+
+/**
+ * Changes the baudrate.
+ * @param context The context associated with the device.
+ * @param value An integer representing the baudrate.
+ * @return 0 on success, -EINVAL if the specified value is invalid.
+ */
+static int bcm283x_i2c_change_baudrate(i2c_bcm283x_context_t *context, const int value) {
+
+	if(value > 0 && value <= BCM283X_I2C_BUS_SPEED_MAX){
+		context->config.baudrate = value;
+		context->config.clock_divider = 0;
+		if(context->config.flags&4)
+			printk(KERN_DEBUG "%s: Changing baudrate to %d.\r\n", __FUNCTION__, value);
+		/* Converted to a divider by the next transaction, with the core clock of the moment */
+		context->config.speed.bus_hz = value;
+		context->config.speed.divider = 0;
+		return 0;
+	}
+	printk(KERN_ERR "%s: Unexpected value!\r\n", __FUNCTION__);
+	return -EINVAL;
+
+}
+
+/**
+ * Changes the clock divider.
+ * @param context The context associated with the device.
+ * @param value An integer representing a clock divider preference.
+ * @return 0 on success, -EINVAL if the specified value is invalid.
+ */
+static int bcm283x_i2c_change_clock_divider(i2c_bcm283x_context_t *context, const int value) {
+
+	/*  Check if the value is valid, the controller ignores the lowest bit  */
+	if (value < 2 || value > 0xFFFF) {
+		printk(KERN_ERR "%s: Unexpected value!\r\n", __FUNCTION__);
+		return -EINVAL;
+	}
+
+	//DEBUG OUTPUT
+	if(context->config.flags&4)
+		printk(KERN_DEBUG "%s: Changing clock divider to %d.\r\n", __FUNCTION__, value);
+
+	context->config.clock_divider = value;
+	context->config.baudrate = 0;
+	/* The divider is nominal, it stands for the same rate whatever the core clock */
+	context->config.speed.bus_hz = 0;
+	context->config.speed.divider = value & 0xFFFE;
+	return 0;
+}
+
+/**
+ * Changes the bus speed from a target SCL rate.
+ * @param context The context associated with the device.
+ * @param value The target SCL rate, in Hz.
+ * @return The SCL rate achieved with the current core clock, -EINVAL if the specified value is invalid.
+ */
+static int bcm283x_i2c_change_bus_speed(i2c_bcm283x_context_t *context, const int value) {
+
+	unsigned long clk_hz;
+
+	if (value <= 0 || value > BCM283X_I2C_BUS_SPEED_MAX) {
+		printk(KERN_ERR "%s: Unexpected value!\r\n", __FUNCTION__);
+		return -EINVAL;
+	}
+
+	context->config.baudrate = value;
+	context->config.clock_divider = 0;
+	context->config.speed.bus_hz = value;
+	context->config.speed.divider = 0;
+
+	clk_hz = READ_ONCE(i2c_bcm283x_clk_hz);
+	return clk_hz / bcm283x_i2c_divider(&context->config.speed, clk_hz);
+}
+
+/**
+ * Changes the slave address.
+ * @param context The context associated with the device.
+ * @param value An 'uint8-t' with the value of the address.
+ * @return 0 on success, -EINVAL if the specified value is invalid.
+ */
+static int bcm283x_i2c_change_slave_address(i2c_bcm283x_context_t *context, const uint8_t value) {
+
+	/*  Check if the value is valid  */
+	if(value > 0){
+				
+		//DEBUG OUTPUT
+		if(context->config.flags&4)
+			printk(KERN_DEBUG "%s: Changing slave address to %x.\r\n", __FUNCTION__, value);
+		
+		context->config.slave_address = value;	
+		return 0;
+	}
+	printk(KERN_ERR "%s: Unexpected value!\r\n", __FUNCTION__);
+	return -EINVAL;
+}
+
+/**
+ * Changes the slave register address.
+ * @param context The context associated with the device.
+ * @param value An 'char' with the value of the register address.
+ * @return 0 on success, -EINVAL if the specified value is invalid.
+ */
+static int bcm283x_i2c_change_slave_register_address(i2c_bcm283x_context_t *context, char value) {
+
+	/*  Check if the value is valid  */
+	if(value > 0){
+		
+		//DEBUG OUTPUT
+		if(context->config.flags&4)
+			printk(KERN_DEBUG "%s: Changing slave register address to %x.\r\n", __FUNCTION__, value);
+		
+		context->config.register_address = value;
+		return 0;
+	}
+	printk(KERN_ERR "%s: Unexpected value!\r\n", __FUNCTION__);
+	return -EINVAL;
+}
+
+/**
+ * Changes the commands pointer.
+ * @param context The context associated with the device.
+ * @param value An 'char' pointer to the commands array.
+ * @return 0 on success, -EINVAL if the specified value is invalid.
+ */
+static int bcm283x_i2c_change_cmds(i2c_bcm283x_context_t *context, char* value) {
+
+	/*  Check if the value is valid  */
+	if(value && context->config.cmds_size > 0){
+		
+		//DEBUG OUTPUT
+		if(context->config.flags&4){
+			printk(KERN_DEBUG "%s: Changing cmds to 0x%02x (first cmds pos).\r\n", __FUNCTION__, value[0]);
+		}
+		
+		context->config.cmds = value;
+		return 0;
+	}
+	
+	if(context->config.cmds_size < 0)
+		printk(KERN_ERR "%s: Set first the commands size!\r\n", __FUNCTION__);
+	else
+		printk(KERN_ERR "%s: Unexpected value!\r\n", __FUNCTION__);
+	
+	
+	return -EINVAL;
+}
+
+/**
+ * Changes the commands size.
+ * @param context The context associated with the device.
+ * @param value An 'uint8_t' with the size of the commands array.
+ * @return 0 on success, -EINVAL if the specified value is invalid.
+ */
+static int bcm283x_i2c_change_cmds_size(i2c_bcm283x_context_t *context, const uint8_t value) {
+
+	/*  Check if the value is valid  */
+	if(value > 0 && value < BCM283X_I2C_BUFFER_SIZE_MAX){
+		
+		//DEBUG OUTPUT
+		if(context->config.flags&4)
+			printk(KERN_DEBUG "%s: Changing cmds size to %d.\r\n", __FUNCTION__, value);
+			
+		context->config.cmds_size = value;
+		return 0;
+	}
+	printk(KERN_ERR "%s: Unexpected value!\r\n", __FUNCTION__);
+	return -EINVAL;
+}
+
+/**
+ * Changes the flags.
+ * @param context The context associated with the device.
+ * @param value An 'uint8_t' with the flags preference [MAX_VALUE 7].
+ * @return 0 on success, -EINVAL if the specified value is invalid.
+ */
+static int bcm283x_i2c_set_flags(i2c_bcm283x_context_t *context, const uint8_t value) {
+
+	/*  Check if the value is valid  */
+	if(value > 0 && value < 16){
+		
+		//DEBUG OUTPUT
+		if(context->config.flags&4)
+			printk(KERN_DEBUG "%s: Changing flags to %d.\r\n", __FUNCTION__, value);
+
+		context->config.flags = value;
+		return 0;
+	}
+	printk(KERN_ERR "%s: Unexpected value!\r\n", __FUNCTION__);
+	return -EINVAL;
+}
+
+/**
+ * Changes the CRC checking of the data and computes the table of its polynomial. The table is computed aside
+ * and swapped in under the data lock, so a concurrent transfer checks its data against one table only.
+ * @param fd File descriptor.
+ * @param context The context associated with the device.
+ * @param arg The bcm283x_i2c_crc_t describing the CRC, in user space.
+ * @return 0 on success, -EINVAL if the configuration is invalid, or another negative error code.
+ */
+static int bcm283x_i2c_set_crc(struct rtdm_fd *fd, i2c_bcm283x_context_t *context, const void __user *arg) {
+
+	bcm283x_i2c_crc_t config;
+	crc_t crc;
+	uint8_t value;
+	int res, i, bit;
+
+	res = rtdm_safe_copy_from_user(fd, &config, arg, sizeof(config));
+	if (res) {
+		printk(KERN_ERR "%s: Can't retrieve argument from user space (%d)!\r\n", __FUNCTION__, res);
+		return (res < 0) ? res : -res;
+	}
+
+	switch (config.mode) {
+		case BCM283X_I2C_CRC_NONE:
+			break;
+
+		case BCM283X_I2C_CRC_PEC:
+			config.poly = 0x07;
+			config.init = 0;
+			break;
+
+		case BCM283X_I2C_CRC_WORD:
+			if (config.word_len == 0 || config.word_len > BCM283X_I2C_CRC_WORD_MAX) {
+				printk(KERN_ERR "%s: Unexpected word length (%u)!\r\n", __FUNCTION__, config.word_len);
+				return -EINVAL;
+			}
+			break;
+
+		default:
+			printk(KERN_ERR "%s: Unexpected mode (%u)!\r\n", __FUNCTION__, config.mode);
+			return -EINVAL;
+	}
+
+	for (i = 0; i < 256; i++) {
+		value = i;
+		for (bit = 0; bit < 8; bit++)
+			value = (value & 0x80) ? (value << 1) ^ config.poly : value << 1;
+		crc.table[i] = value;
+	}
+
+	crc.mode = config.mode;
+	crc.init = config.init;
+	crc.word_len = config.word_len;
+
+	res = rtdm_mutex_lock(&context->data_lock);
+	if (res)
+		return res;
+	context->crc = crc;
+	rtdm_mutex_unlock(&context->data_lock);
+
+	return 0;
+
+}
+
+/**
+ * Sets up the register cache of the slave of a device instance.
+ * @param fd File descriptor.
+ * @param context The context associated with the device.
+ * @param arg The bcm283x_i2c_regmap_t describing the registers, in user space.
+ * @return 0 on success, -EINVAL if a range is invalid, or another negative error code.
+ */
+static int bcm283x_i2c_regmap_setup(struct rtdm_fd *fd, i2c_bcm283x_context_t *context, const void __user *arg) {
+
+	bcm283x_i2c_regmap_t setup;
+	bcm283x_i2c_reg_range_t ranges[BCM283X_I2C_REGMAP_RANGES_MAX];
+	regmap_t *regmap = &context->regmap;
+	int res, i;
+
+	res = rtdm_safe_copy_from_user(fd, &setup, arg, sizeof(setup));
+	if (res) {
+		printk(KERN_ERR "%s: Can't retrieve argument from user space (%d)!\r\n", __FUNCTION__, res);
+		return (res < 0) ? res : -res;
+	}
+
+	if (setup.nranges > BCM283X_I2C_REGMAP_RANGES_MAX) {
+		printk(KERN_ERR "%s: Unexpected number of ranges (%u)!\r\n", __FUNCTION__, setup.nranges);
+		return -EINVAL;
+	}
+
+	if (setup.nranges > 0) {
+		res = rtdm_safe_copy_from_user(fd, ranges, setup.ranges, setup.nranges * sizeof(bcm283x_i2c_reg_range_t));
+		if (res) {
+			printk(KERN_ERR "%s: Can't retrieve ranges from user space (%d)!\r\n", __FUNCTION__, res);
+			return (res < 0) ? res : -res;
+		}
+	}
+
+	for (i = 0; i < setup.nranges; i++) {
+		if (ranges[i].first > ranges[i].last || ranges[i].type > BCM283X_I2C_REG_WRITE_BACK) {
+			printk(KERN_ERR "%s: Unexpected range %d!\r\n", __FUNCTION__, i);
+			return -EINVAL;
+		}
+	}
+
+	memset(regmap->type, BCM283X_I2C_REG_VOLATILE, sizeof(regmap->type));
+	memset(regmap->state, 0, sizeof(regmap->state));
+	for (i = 0; i < setup.nranges; i++)
+		memset(regmap->type + ranges[i].first, ranges[i].type, ranges[i].last - ranges[i].first + 1);
+
+	regmap->addr = context->config.slave_address;
+	regmap->enabled = (setup.nranges > 0);
+
+	return 0;
+
+}
+
+/**
+ * Retrieves and checks the registers to access through the register cache.
+ * @param fd File descriptor.
+ * @param context The context associated with the device.
+ * @param arg The bcm283x_i2c_reg_access_t describing the access, in user space.
+ * @param access Where to store the access.
+ * @return 0 on success, -EINVAL if the cache is disabled or the registers are out of range, or another negative error code.
+ */
+static int bcm283x_i2c_regmap_access(struct rtdm_fd *fd, i2c_bcm283x_context_t *context, const void __user *arg, bcm283x_i2c_reg_access_t *access) {
+
+	int res;
+
+	res = rtdm_safe_copy_from_user(fd, access, arg, sizeof(*access));
+	if (res) {
+		printk(KERN_ERR "%s: Can't retrieve argument from user space (%d)!\r\n", __FUNCTION__, res);
+		return (res < 0) ? res : -res;
+	}
+
+	if (!context->regmap.enabled || access->len == 0 || access->reg + access->len > 256) {
+		printk(KERN_ERR "%s: Unexpected access!\r\n", __FUNCTION__);
+		return -EINVAL;
+	}
+
+	return 0;
+
+}
+
+/**
+ * Reads consecutive registers of the slave through the register cache.
+ * @param fd File descriptor.
+ * @param context The context associated with the device.
+ * @param arg The bcm283x_i2c_reg_access_t describing the access, in user space.
+ * @return The I2C return code of the transaction, BCM2835_I2C_REASON_OK if the cache served the registers.
+ * On failure, a negative error code.
+ */
+static int bcm283x_i2c_regmap_read(struct rtdm_fd *fd, i2c_bcm283x_context_t *context, const void __user *arg) {
+
+	bcm283x_i2c_reg_access_t access;
+	regmap_t *regmap = &context->regmap;
+	segment_t segs[2];
+	char *data;
+	int res, i;
+
+	res = bcm283x_i2c_regmap_access(fd, context, arg, &access);
+	if (res)
+		return res;
+
+	/* Serve the registers from memory if they are all cached */
+	for (i = access.reg; i < access.reg + access.len; i++)
+		if (regmap->type[i] == BCM283X_I2C_REG_VOLATILE || !(regmap->state[i] & REG_VALID))
+			break;
+
+	if (i == access.reg + access.len) {
+		data = (char *)regmap->value + access.reg;
+		res = BCM2835_I2C_REASON_OK;
+	} else {
+		data = context->receive_buffer.data;
+
+		segs[0].addr = regmap->addr;
+		segs[0].flags = 0;
+		segs[0].len = 1;
+		segs[0].buf = (char *)&access.reg;
+		segs[1].addr = regmap->addr;
+		segs[1].flags = SEGMENT_READ;
+		segs[1].len = access.len;
+		segs[1].buf = data;
+		res = bcm283x_i2c_transaction(context, segs, 2);
+		if (res != BCM2835_I2C_REASON_OK)
+			return res;
+
+		/* Fill the cache, values not written to the slave yet are newer than the ones read */
+		for (i = 0; i < access.len; i++) {
+			if (regmap->type[access.reg + i] == BCM283X_I2C_REG_VOLATILE)
+				continue;
+			if (regmap->state[access.reg + i] & REG_DIRTY) {
+				data[i] = regmap->value[access.reg + i];
+			} else {
+				regmap->value[access.reg + i] = data[i];
+				regmap->state[access.reg + i] = REG_VALID;
+			}
+		}
+	}
+
+	res = rtdm_safe_copy_to_user(fd, access.buf, data, access.len);
+	if (res) {
+		printk(KERN_ERR "%s: Can't copy data from driver to user space (%d)!\r\n", __FUNCTION__, res);
+		return (res < 0) ? res : -res;
+	}
+
+	return BCM2835_I2C_REASON_OK;
+
+}
+
+/**
+ * Writes consecutive registers of the slave through the register cache.
+ * @param fd File descriptor.
+ * @param context The context associated with the device.
+ * @param arg The bcm283x_i2c_reg_access_t describing the access, in user space.
+ * @return The I2C return code of the transaction, BCM2835_I2C_REASON_OK if only the cache was updated.
+ * On failure, -EPERM if a register is read-only, or another negative error code.
+ */
+static int bcm283x_i2c_regmap_write(struct rtdm_fd *fd, i2c_bcm283x_context_t *context, const void __user *arg) {
+
+	bcm283x_i2c_reg_access_t access;
+	regmap_t *regmap = &context->regmap;
+	segment_t seg;
+	char *data = context->transmit_buffer.data + 1;
+	int res, i, back = 1;
+
+	res = bcm283x_i2c_regmap_access(fd, context, arg, &access);
+	if (res)
+		return res;
+
+	for (i = access.reg; i < access.reg + access.len; i++) {
+		if (regmap->type[i] == BCM283X_I2C_REG_READ_ONLY) {
+			printk(KERN_ERR "%s: Register 0x%02x is read-only!\r\n", __FUNCTION__, i);
+			return -EPERM;
+		}
+		if (regmap->type[i] != BCM283X_I2C_REG_WRITE_BACK)
+			back = 0;
+	}
+
+	res = rtdm_safe_copy_from_user(fd, data, access.buf, access.len);
+	if (res) {
+		printk(KERN_ERR "%s: Can't copy data from user space to driver (%d)!\r\n", __FUNCTION__, res);
+		return (res < 0) ? res : -res;
+	}
+
+	/* Write-back registers are written by the next sync */
+	if (back) {
+		memcpy(regmap->value + access.reg, data, access.len);
+		memset(regmap->state + access.reg, REG_VALID | REG_DIRTY, access.len);
+		return BCM2835_I2C_REASON_OK;
+	}
+
+	context->transmit_buffer.data[0] = access.reg;
+	seg.addr = regmap->addr;
+	seg.flags = 0;
+	seg.len = access.len + 1;
+	seg.buf = context->transmit_buffer.data;
+	res = bcm283x_i2c_transaction(context, &seg, 1);
+	if (res != BCM2835_I2C_REASON_OK)
+		return res;
+
+	for (i = 0; i < access.len; i++) {
+		if (regmap->type[access.reg + i] == BCM283X_I2C_REG_VOLATILE)
+			continue;
+		regmap->value[access.reg + i] = data[i];
+		regmap->state[access.reg + i] = REG_VALID;
+	}
+
+	return BCM2835_I2C_REASON_OK;
+
+}
+
+/**
+ * Writes the registers changed in the cache to the slave, each run of consecutive registers in a segment.
+ * @param context The context associated with the device.
+ * @return The I2C return code of the last transaction, BCM2835_I2C_REASON_OK if there was nothing to write.
+ * On failure, -EINVAL if the cache is disabled, or another negative error code.
+ */
+static int bcm283x_i2c_regmap_sync(i2c_bcm283x_context_t *context) {
+
+	regmap_t *regmap = &context->regmap;
+	segment_t segs[BCM283X_I2C_SEGMENTS_MAX];
+	char *pos;
+	int res, reg = 0, nsegs, i, j;
+
+	if (!regmap->enabled)
+		return -EINVAL;
+
+	while (reg < 256) {
+
+		/* Lay out a transaction worth of runs in the transmit buffer, each opened by its register address */
+		pos = context->transmit_buffer.data;
+		nsegs = 0;
+		while (reg < 256 && nsegs < BCM283X_I2C_SEGMENTS_MAX) {
+			if (!(regmap->state[reg] & REG_DIRTY)) {
+				reg++;
+				continue;
+			}
+			segs[nsegs].addr = regmap->addr;
+			segs[nsegs].flags = 0;
+			segs[nsegs].buf = pos;
+			*pos++ = reg;
+			while (reg < 256 && (regmap->state[reg] & REG_DIRTY))
+				*pos++ = regmap->value[reg++];
+			segs[nsegs].len = pos - segs[nsegs].buf;
+			nsegs++;
+		}
+
+		if (nsegs == 0)
+			break;
+
+		res = bcm283x_i2c_transaction(context, segs, nsegs);
+		if (res != BCM2835_I2C_REASON_OK)
+			return res;
+
+		for (i = 0; i < nsegs; i++)
+			for (j = 1; j < segs[i].len; j++)
+				regmap->state[(uint8_t)segs[i].buf[0] + j - 1] &= ~REG_DIRTY;
+	}
+
+	return BCM2835_I2C_REASON_OK;
+
+}
+
+/**
+ * Lays out the command code and a block to write, with its length byte first.
+ * @param out Where to lay them out, BCM283X_I2C_SMBUS_BLOCK_MAX + 2 bytes.
+ * @param block The length of the block followed by its data.
+ * @return The number of bytes to write, 0 if the length is invalid.
+ */
+static uint16_t bcm283x_i2c_smbus_block(char *out, const uint8_t *block) {
+
+	if (block[0] == 0 || block[0] > BCM283X_I2C_SMBUS_BLOCK_MAX) {
+		printk(KERN_ERR "%s: Unexpected block length (%u)!\r\n", __FUNCTION__, block[0]);
+		return 0;
+	}
+
+	memcpy(out + 1, block, block[0] + 1);
+	return block[0] + 2;
+
+}
+
+/**
+ * Runs an SMBus command on the slave of a device instance: the command code and the data to write are sent
+ * first, then the reply is read after a repeated start, like bcm2835_i2c_write_read_rs() does.
+ * @param fd File descriptor.
+ * @param context The context associated with the device.
+ * @param arg The bcm283x_i2c_smbus_t describing the command, in user space.
+ * @return The I2C return code on completion, see bcm2835I2CReasonCodes. On failure, a negative error code.
+ */
+static int bcm283x_i2c_smbus(struct rtdm_fd *fd, i2c_bcm283x_context_t *context, void __user *arg) {
+
+	bcm283x_i2c_smbus_t smbus;
+	char out[BCM283X_I2C_SMBUS_BLOCK_MAX + 3];
+	segment_t segs[2];
+	uint16_t wlen = 1, rlen = 0;
+	int read, res, first, nsegs;
+	int pec = (context->crc.mode == BCM283X_I2C_CRC_PEC);
+
+	res = rtdm_safe_copy_from_user(fd, &smbus, arg, sizeof(smbus));
+	if (res) {
+		printk(KERN_ERR "%s: Can't retrieve argument from user space (%d)!\r\n", __FUNCTION__, res);
+		return (res < 0) ? res : -res;
+	}
+
+	read = (smbus.read_write == BCM283X_I2C_SMBUS_READ);
+	out[0] = smbus.command;
+
+	switch (smbus.protocol) {
+		case BCM283X_I2C_SMBUS_BYTE:
+			/* Receive byte has no command code */
+			if (read) {
+				wlen = 0;
+				rlen = 1;
+			}
+			break;
+
+		case BCM283X_I2C_SMBUS_BYTE_DATA:
+			if (read)
+				rlen = 1;
+			else
+				out[wlen++] = smbus.data[0];
+			break;
+
+		case BCM283X_I2C_SMBUS_WORD_DATA:
+			if (read) {
+				rlen = 2;
+				break;
+			}
+			out[wlen++] = smbus.data[0];
+			out[wlen++] = smbus.data[1];
+			break;
+
+		case BCM283X_I2C_SMBUS_PROC_CALL:
+			out[wlen++] = smbus.data[0];
+			out[wlen++] = smbus.data[1];
+			rlen = 2;
+			break;
+
+		case BCM283X_I2C_SMBUS_BLOCK_DATA:
+			if (read) {
+				rlen = BCM283X_I2C_SMBUS_BLOCK_MAX + 1;
+				break;
+			}
+			wlen = bcm283x_i2c_smbus_block(out, smbus.data);
+			if (wlen == 0)
+				return -EINVAL;
+			break;
+
+		case BCM283X_I2C_SMBUS_BLOCK_PROC_CALL:
+			wlen = bcm283x_i2c_smbus_block(out, smbus.data);
+			if (wlen == 0)
+				return -EINVAL;
+			rlen = BCM283X_I2C_SMBUS_BLOCK_MAX + 1;
+			break;
+
+		default:
+			printk(KERN_ERR "%s: Unexpected protocol (%u)!\r\n", __FUNCTION__, smbus.protocol);
+			return -EINVAL;
+	}
+
+	/* The reply is read in place, a block with its length byte first, and followed by the PEC if enabled */
+	segs[0].addr = context->config.slave_address;
+	segs[0].flags = 0;
+	segs[0].len = wlen;
+	segs[0].buf = out;
+	segs[1].addr = context->config.slave_address;
+	segs[1].flags = SEGMENT_READ;
+	segs[1].len = rlen + (rlen && pec);
+	segs[1].buf = (char *)smbus.data;
+
+	/* Receive byte has no command code, the others only read if they expect a reply */
+	first = wlen ? 0 : 1;
+	nsegs = (wlen && rlen) ? 2 : 1;
+
+	if (pec && !rlen) {
+		res = bcm283x_i2c_crc_encode(&context->crc, segs, 1, sizeof(out));
+		if (res < 0)
+			return res;
+	}
+
+	res = bcm283x_i2c_transaction(context, segs + first, nsegs);
+	if (res != BCM2835_I2C_REASON_OK || !rlen)
+		return res;
+
+	if (rlen == BCM283X_I2C_SMBUS_BLOCK_MAX + 1) {
+		if (smbus.data[0] == 0 || smbus.data[0] > BCM283X_I2C_SMBUS_BLOCK_MAX) {
+			printk(KERN_ERR "%s: Unexpected block length (%u) from the slave!\r\n", __FUNCTION__, smbus.data[0]);
+			return -EPROTO;
+		}
+		/* The PEC follows the block, not what was clocked in past it */
+		segs[1].len = smbus.data[0] + 1 + pec;
+	}
+
+	if (pec) {
+		res = bcm283x_i2c_crc_decode(&context->crc, segs + first, nsegs);
+		if (res < 0)
+			return res;
+	}
+
+	/* Drop what was clocked in past the reply */
+	memset(smbus.data + segs[1].len, 0, sizeof(smbus.data) - segs[1].len);
+
+	res = rtdm_safe_copy_to_user(fd, arg, &smbus, sizeof(smbus));
+	if (res) {
+		printk(KERN_ERR "%s: Can't copy data from driver to user space (%d)!\r\n", __FUNCTION__, res);
+		return (res < 0) ? res : -res;
+	}
+
+	return BCM2835_I2C_REASON_OK;
+
+}
+
+/**
+ * Runs a transaction made of several segments, as described by the user.
+ * The data of all segments is staged in the transmit buffer.
+ * @param fd File descriptor.
+ * @param context The context associated with the device.
+ * @param arg The bcm283x_i2c_transfer_t describing the transaction, in user space.
+ * @return The I2C return code on completion, see bcm2835I2CReasonCodes. On failure, a negative error code.
+ */
+static int bcm283x_i2c_transfer(struct rtdm_fd *fd, i2c_bcm283x_context_t *context, const void __user *arg) {
+
+	bcm283x_i2c_transfer_t transfer;
+	bcm283x_i2c_msg_t msgs[BCM283X_I2C_SEGMENTS_MAX];
+	segment_t segs[BCM283X_I2C_SEGMENTS_MAX];
+	size_t size = 0;
+	int res, i;
+
+	res = rtdm_safe_copy_from_user(fd, &transfer, arg, sizeof(transfer));
+	if (res) {
+		printk(KERN_ERR "%s: Can't retrieve argument from user space (%d)!\r\n", __FUNCTION__, res);
+		return (res < 0) ? res : -res;
+	}
+
+	if (transfer.nmsgs == 0 || transfer.nmsgs > BCM283X_I2C_SEGMENTS_MAX) {
+		printk(KERN_ERR "%s: Unexpected number of segments (%u)!\r\n", __FUNCTION__, transfer.nmsgs);
+		return -EINVAL;
+	}
+
+	res = rtdm_safe_copy_from_user(fd, msgs, transfer.msgs, transfer.nmsgs * sizeof(bcm283x_i2c_msg_t));
+	if (res) {
+		printk(KERN_ERR "%s: Can't retrieve segments from user space (%d)!\r\n", __FUNCTION__, res);
+		return (res < 0) ? res : -res;
+	}
+
+	/* Lay out the segments in the transmit buffer and fetch the data to write */
+	for (i = 0; i < transfer.nmsgs; i++) {
+
+		segs[i].addr = msgs[i].addr;
+		segs[i].flags = msgs[i].flags & SEGMENT_READ;
+		segs[i].len = msgs[i].len;
+
+		if (msgs[i].addr > 0x7F) {
+			printk(KERN_ERR "%s: Unexpected segment %d!\r\n", __FUNCTION__, i);
+			return -EINVAL;
+		}
+
+		/* Registered buffers are used in place */
+		if (msgs[i].flags & BCM283X_I2C_M_POOL) {
+			segs[i].buf = bcm283x_i2c_pool_buffer(context, msgs[i].buffer, msgs[i].len);
+			if (!segs[i].buf) {
+				printk(KERN_ERR "%s: Unexpected pool buffer in segment %d!\r\n", __FUNCTION__, i);
+				return -EINVAL;
+			}
+			continue;
+		}
+
+		if (msgs[i].len > BCM283X_I2C_BUFFER_SIZE_MAX - size) {
+			printk(KERN_ERR "%s: Unexpected segment %d!\r\n", __FUNCTION__, i);
+			return -EINVAL;
+		}
+
+		segs[i].buf = context->transmit_buffer.data + size;
+		size += msgs[i].len;
+
+		if (!(segs[i].flags & SEGMENT_READ) && segs[i].len > 0) {
+			res = rtdm_safe_copy_from_user(fd, segs[i].buf, msgs[i].buf, segs[i].len);
+			if (res) {
+				printk(KERN_ERR "%s: Can't copy data from user space to driver (%d)!\r\n", __FUNCTION__, res);
+				return (res < 0) ? res : -res;
+			}
+		}
+	}
+	context->transmit_buffer.size = size;
+
+	res = bcm283x_i2c_transaction(context, segs, transfer.nmsgs);
+	if (res != BCM2835_I2C_REASON_OK)
+		return res;
 
-	/*  Check if the value is valid  */
-	switch (value) {
-		case BCM2835_I2C_CLOCK_DIVIDER_2500:
-		case BCM2835_I2C_CLOCK_DIVIDER_626:
-		case BCM2835_I2C_CLOCK_DIVIDER_150:
-		case BCM2835_I2C_CLOCK_DIVIDER_148:
-			
-			//DEBUG OUTPUT
-			if(context->config.flags&4)
-				printk(KERN_DEBUG "%s: Changing clock divider to %d.\r\n", __FUNCTION__, value);
-				
-			context->config.clock_divider = value;
-			context->config.baudrate = 0;
-			
-			bcm2835_i2c_setClockDivider((uint16_t)context->config.clock_divider);
-			return 0;
+	/* Copy the data read to user space */
+	for (i = 0; i < transfer.nmsgs; i++) {
+		if ((segs[i].flags & SEGMENT_READ) && !(msgs[i].flags & BCM283X_I2C_M_POOL) && segs[i].len > 0) {
+			res = rtdm_safe_copy_to_user(fd, msgs[i].buf, segs[i].buf, segs[i].len);
+			if (res) {
+				printk(KERN_ERR "%s: Can't copy data from driver to user space (%d)!\r\n", __FUNCTION__, res);
+				return (res < 0) ? res : -res;
+			}
+		}
 	}
 
-	printk(KERN_ERR "%s: Unexpected value!\r\n", __FUNCTION__);
-	return -EINVAL;
+	return BCM2835_I2C_REASON_OK;
+
 }
 
 /**
- * Changes the slave address.
+ * Copies the statistics of the bus of a device instance to user space.
+ * @param fd File descriptor.
  * @param context The context associated with the device.
- * @param value An 'uint8-t' with the value of the address.
- * @return 0 on success, -EINVAL if the specified value is invalid.
+ * @param arg The bcm283x_i2c_stats_t, in user space.
+ * @return 0 on success. On failure, a negative error code.
  */
-static int bcm283x_i2c_change_slave_address(i2c_bcm283x_context_t *context, const uint8_t value) {
+static int bcm283x_i2c_get_stats(struct rtdm_fd *fd, i2c_bcm283x_context_t *context, void __user *arg) {
 
-	/*  Check if the value is valid  */
-	if(value > 0){
-				
-		//DEBUG OUTPUT
-		if(context->config.flags&4)
-			printk(KERN_DEBUG "%s: Changing slave address to %x.\r\n", __FUNCTION__, value);
-		
-		context->config.slave_address = value;	
-			
-		bcm2835_i2c_setSlaveAddress(context->config.slave_address);
-		return 0;
-	}
-	printk(KERN_ERR "%s: Unexpected value!\r\n", __FUNCTION__);
-	return -EINVAL;
-}
+	bcm283x_i2c_stats_t stats;
+	rtdm_lockctx_t lock_ctx;
+	int res;
 
-/**
- * Changes the slave register address.
- * @param context The context associated with the device.
- * @param value An 'char' with the value of the register address.
- * @return 0 on success, -EINVAL if the specified value is invalid.
- */
-static int bcm283x_i2c_change_slave_register_address(i2c_bcm283x_context_t *context, char value) {
+	rtdm_lock_get_irqsave(&context->bus->gate_lock, lock_ctx);
+	stats = context->bus->stats;
+	rtdm_lock_put_irqrestore(&context->bus->gate_lock, lock_ctx);
 
-	/*  Check if the value is valid  */
-	if(value > 0){
-		
-		//DEBUG OUTPUT
-		if(context->config.flags&4)
-			printk(KERN_DEBUG "%s: Changing slave register address to %x.\r\n", __FUNCTION__, value);
-		
-		context->config.register_address = value;
-		return 0;
+	res = rtdm_safe_copy_to_user(fd, arg, &stats, sizeof(stats));
+	if (res) {
+		printk(KERN_ERR "%s: Can't copy statistics from driver to user space (%d)!\r\n", __FUNCTION__, res);
+		return (res < 0) ? res : -res;
 	}
-	printk(KERN_ERR "%s: Unexpected value!\r\n", __FUNCTION__);
-	return -EINVAL;
+
+	return 0;
+
 }
 
 /**
- * Changes the commands pointer.
+ * Changes the deadline of the transactions of a device instance.
+ * @param fd File descriptor.
  * @param context The context associated with the device.
- * @param value An 'char' pointer to the commands array.
- * @return 0 on success, -EINVAL if the specified value is invalid.
+ * @param arg The bcm283x_i2c_deadline_t, in user space.
+ * @return 0 on success. On failure, a negative error code.
  */
-static int bcm283x_i2c_change_cmds(i2c_bcm283x_context_t *context, char* value) {
+static int bcm283x_i2c_set_deadline(struct rtdm_fd *fd, i2c_bcm283x_context_t *context, const void __user *arg) {
 
-	/*  Check if the value is valid  */
-	if(value && context->config.cmds_size > 0){
-		
-		//DEBUG OUTPUT
-		if(context->config.flags&4){
-			printk(KERN_DEBUG "%s: Changing cmds to 0x%02x (first cmds pos).\r\n", __FUNCTION__, value[0]);
-		}
-		
-		context->config.cmds = value;
-		return 0;
+	bcm283x_i2c_deadline_t deadline;
+	rtdm_lockctx_t lock_ctx;
+	int res;
+
+	res = rtdm_safe_copy_from_user(fd, &deadline, arg, sizeof(deadline));
+	if (res) {
+		printk(KERN_ERR "%s: Can't retrieve argument from user space (%d)!\r\n", __FUNCTION__, res);
+		return (res < 0) ? res : -res;
 	}
-	
-	if(context->config.cmds_size < 0)
-		printk(KERN_ERR "%s: Set first the commands size!\r\n", __FUNCTION__);
-	else
+
+	if (deadline.ns < 0 || (deadline.flags & ~BCM283X_I2C_DEADLINE_ABS)) {
 		printk(KERN_ERR "%s: Unexpected value!\r\n", __FUNCTION__);
-	
-	
-	return -EINVAL;
-}
+		return -EINVAL;
+	}
 
-/**
- * Changes the commands size.
- * @param context The context associated with the device.
- * @param value An 'uint8_t' with the size of the commands array.
- * @return 0 on success, -EINVAL if the specified value is invalid.
- */
-static int bcm283x_i2c_change_cmds_size(i2c_bcm283x_context_t *context, const uint8_t value) {
+	rtdm_lock_get_irqsave(&context->sched.lock, lock_ctx);
+	if (deadline.flags & BCM283X_I2C_DEADLINE_ABS)
+		context->config.absolute_deadline = deadline.ns;
+	else
+		context->config.relative_deadline = deadline.ns;
+	rtdm_lock_put_irqrestore(&context->sched.lock, lock_ctx);
+
+	return 0;
 
-	/*  Check if the value is valid  */
-	if(value > 0 && value < BCM283X_I2C_BUFFER_SIZE_MAX){
-		
-		//DEBUG OUTPUT
-		if(context->config.flags&4)
-			printk(KERN_DEBUG "%s: Changing cmds size to %d.\r\n", __FUNCTION__, value);
-			
-		context->config.cmds_size = value;
-		return 0;
-	}
-	printk(KERN_ERR "%s: Unexpected value!\r\n", __FUNCTION__);
-	return -EINVAL;
 }
 
 /**
- * Changes the flags.
+ * Changes the retry policy of the transactions of a device instance.
+ * @param fd File descriptor.
  * @param context The context associated with the device.
- * @param value An 'uint8_t' with the flags preference [MAX_VALUE 7].
- * @return 0 on success, -EINVAL if the specified value is invalid.
+ * @param arg The bcm283x_i2c_retry_t, in user space.
+ * @return 0 on success. On failure, a negative error code.
  */
-static int bcm283x_i2c_set_flags(i2c_bcm283x_context_t *context, const uint8_t value) {
+static int bcm283x_i2c_set_retry(struct rtdm_fd *fd, i2c_bcm283x_context_t *context, const void __user *arg) {
 
-	/*  Check if the value is valid  */
-	if(value > 0 && value < 16){
-		
-		//DEBUG OUTPUT
-		if(context->config.flags&4)
-			printk(KERN_DEBUG "%s: Changing flags to %d.\r\n", __FUNCTION__, value);
+	bcm283x_i2c_retry_t retry;
+	int res;
 
-		context->config.flags = value;
-		return 0;
+	res = rtdm_safe_copy_from_user(fd, &retry, arg, sizeof(retry));
+	if (res) {
+		printk(KERN_ERR "%s: Can't retrieve argument from user space (%d)!\r\n", __FUNCTION__, res);
+		return (res < 0) ? res : -res;
 	}
-	printk(KERN_ERR "%s: Unexpected value!\r\n", __FUNCTION__);
-	return -EINVAL;
+
+	if (retry.count > BCM283X_I2C_RETRY_MAX || retry.backoff_us > BCM283X_I2C_RETRY_BACKOFF_MAX_US
+		|| (retry.reasons & ~(BCM2835_I2C_REASON_ERROR_NACK | BCM2835_I2C_REASON_ERROR_CLKT | BCM2835_I2C_REASON_ERROR_DATA | BCM2835_I2C_REASON_ERROR_TIMEOUT))
+		|| (retry.flags & ~BCM283X_I2C_RETRY_EXPONENTIAL)) {
+		printk(KERN_ERR "%s: Unexpected value!\r\n", __FUNCTION__);
+		return -EINVAL;
+	}
+
+	context->config.retry = retry;
+
+	return 0;
+
 }
 
 /**
- * IOCTL handler.
+ * Runs an IOCTL request in primary mode, see bcm283x_i2c_rtdm_ioctl_rt().
  * @param[in] fd File descriptor.
  * @param[in] request Request number as passed by the user.
  * @param[in,out] arg Request argument as passed by the user.
  * @return A positive value or 0 on success. On failure return either -ENOSYS, to request that the function be called again from the opposite realtime/non-realtime context, or another negative error code.
  */
-static int bcm283x_i2c_rtdm_ioctl_rt(struct rtdm_fd *fd, unsigned int request, void __user *arg) {
+static int bcm283x_i2c_ioctl(struct rtdm_fd *fd, unsigned int request, void __user *arg) {
 
 	i2c_bcm283x_context_t *context;
 	int interger;
@@ -440,9 +3878,14 @@ static int bcm283x_i2c_rtdm_ioctl_rt(struct rtdm_fd *fd, unsigned int request, v
 	char* charPointer;
 	char character;
 	int res;
+	unsigned long clk_hz;
+	nanosecs_abs_t start;
+	bcm283x_i2c_sched_stats_t sched;
+	rtdm_lockctx_t lock_ctx;
 
 	/* Retrieve context */
 	context = (i2c_bcm283x_context_t *) rtdm_fd_to_private(fd);
+	start = rtdm_clock_read_monotonic();
 
 	/* Analyze request */
 	switch (request) {
@@ -471,6 +3914,22 @@ static int bcm283x_i2c_rtdm_ioctl_rt(struct rtdm_fd *fd, unsigned int request, v
 			}
 			return bcm283x_i2c_change_baudrate(context, interger);
 
+		case BCM283X_I2C_SET_BUS_SPEED: /* Change the bus speed and report the rate achieved */
+			res = rtdm_safe_copy_from_user(fd, &interger, arg, sizeof(int));
+			if (res) {
+				printk(KERN_ERR "%s: Can't retrieve argument from user space (%d)!\r\n", __FUNCTION__, res);
+				return (res < 0) ? res : -res;
+			}
+			interger = bcm283x_i2c_change_bus_speed(context, interger);
+			if (interger < 0)
+				return interger;
+			res = rtdm_safe_copy_to_user(fd, arg, &interger, sizeof(int));
+			if (res) {
+				printk(KERN_ERR "%s: Can't copy bus rate from driver to user space (%d)!\r\n", __FUNCTION__, res);
+				return (res < 0) ? res : -res;
+			}
+			return 0;
+
 		case BCM283X_I2C_SET_CLOCK_DIVIDER: /* Change the clock divider */
 			res = rtdm_safe_copy_from_user(fd, &interger, arg, sizeof(int));
 			if (res) {
@@ -503,6 +3962,136 @@ static int bcm283x_i2c_rtdm_ioctl_rt(struct rtdm_fd *fd, unsigned int request, v
 			}
 			return bcm283x_i2c_set_flags(context, uChar);
 
+		case BCM283X_I2C_TRANSFER: /* Run a multi-segment transaction */
+			res = bcm283x_i2c_transfer(fd, context, arg);
+			bcm283x_i2c_hist_syscall(context, BCM283X_I2C_OP_IOCTL, start);
+			return res;
+
+		case BCM283X_I2C_SMBUS: /* Run an SMBus command */
+			res = bcm283x_i2c_smbus(fd, context, arg);
+			bcm283x_i2c_hist_syscall(context, BCM283X_I2C_OP_IOCTL, start);
+			return res;
+
+		case BCM283X_I2C_SET_CRC: /* Change the CRC checking of the data */
+			return bcm283x_i2c_set_crc(fd, context, arg);
+
+		case BCM283X_I2C_GET_HISTOGRAMS: /* Retrieve the latency histograms of the bus */
+			/* atomic_t holds a plain int, the counts are copied as they are */
+			res = rtdm_safe_copy_to_user(fd, arg, context->bus->hist, sizeof(bcm283x_i2c_histograms_t));
+			if (res) {
+				printk(KERN_ERR "%s: Can't copy histograms from driver to user space (%d)!\r\n", __FUNCTION__, res);
+				return (res < 0) ? res : -res;
+			}
+			return 0;
+
+		case BCM283X_I2C_RESET_HISTOGRAMS: /* Clear the latency histograms of the bus */
+			bcm283x_i2c_hist_reset(context->bus);
+			return 0;
+
+		case BCM283X_I2C_SET_RETRY: /* Change the retry policy of the transactions */
+			return bcm283x_i2c_set_retry(fd, context, arg);
+
+		case BCM283X_I2C_READ_TS: /* Read with timestamps */
+			res = bcm283x_i2c_read_ts(fd, context, arg);
+			bcm283x_i2c_hist_syscall(context, BCM283X_I2C_OP_READ, start);
+			return res;
+
+		case BCM283X_I2C_REGMAP_SETUP: /* Set up the register cache */
+			return bcm283x_i2c_regmap_setup(fd, context, arg);
+
+		case BCM283X_I2C_REGMAP_READ: /* Read registers through the cache */
+			res = bcm283x_i2c_regmap_read(fd, context, arg);
+			bcm283x_i2c_hist_syscall(context, BCM283X_I2C_OP_IOCTL, start);
+			return res;
+
+		case BCM283X_I2C_REGMAP_WRITE: /* Write registers through the cache */
+			res = bcm283x_i2c_regmap_write(fd, context, arg);
+			bcm283x_i2c_hist_syscall(context, BCM283X_I2C_OP_IOCTL, start);
+			return res;
+
+		case BCM283X_I2C_REGMAP_SYNC: /* Write the registers changed in the cache */
+			res = bcm283x_i2c_regmap_sync(context);
+			bcm283x_i2c_hist_syscall(context, BCM283X_I2C_OP_IOCTL, start);
+			return res;
+
+		case BCM283X_I2C_REGMAP_DROP: /* Empty the register cache */
+			memset(context->regmap.state, 0, sizeof(context->regmap.state));
+			return 0;
+
+		case BCM283X_I2C_RING_SETUP: /* Allocation, task management and the setup lock require secondary mode */
+		case BCM283X_I2C_POOL_SETUP:
+		case BCM283X_I2C_SAMPLER_START:
+		case BCM283X_I2C_SAMPLER_STOP:
+		case BCM283X_I2C_SET_DRDY:
+			return -ENOSYS;
+
+		case BCM283X_I2C_SAMPLER_READ: /* Read a batch of samples */
+			return bcm283x_i2c_sampler_read(fd, context, arg);
+
+		case BCM283X_I2C_GET_STATS: /* Retrieve the statistics of the bus */
+			return bcm283x_i2c_get_stats(fd, context, arg);
+
+		case BCM283X_I2C_SET_DEADLINE: /* Change the deadline of the transactions */
+			return bcm283x_i2c_set_deadline(fd, context, arg);
+
+		case BCM283X_I2C_SET_TRANSFER_BUDGET: /* Change the budget of the transfers */
+			res = rtdm_safe_copy_from_user(fd, &interger, arg, sizeof(int));
+			if (res) {
+				printk(KERN_ERR "%s: Can't retrieve argument from user space (%d)!\r\n", __FUNCTION__, res);
+				return (res < 0) ? res : -res;
+			}
+			if (interger < 0) {
+				printk(KERN_ERR "%s: Unexpected value!\r\n", __FUNCTION__);
+				return -EINVAL;
+			}
+			context->config.budget = (nanosecs_rel_t)interger * 1000;
+			return 0;
+
+		case BCM283X_I2C_SET_CLOCK_STRETCH_TIMEOUT: /* Change the clock stretch timeout of the bus */
+			res = rtdm_safe_copy_from_user(fd, &interger, arg, sizeof(int));
+			if (res) {
+				printk(KERN_ERR "%s: Can't retrieve argument from user space (%d)!\r\n", __FUNCTION__, res);
+				return (res < 0) ? res : -res;
+			}
+			if (interger < 0 || interger > 0xFFFF) {
+				printk(KERN_ERR "%s: Unexpected value!\r\n", __FUNCTION__);
+				return -EINVAL;
+			}
+			/* Wait for the bus to be idle before touching it */
+			res = bcm283x_i2c_acquire(context->bus, BCM283X_I2C_NO_DEADLINE);
+			if (res)
+				return res;
+			bcm2835_i2c_setClockStretchTimeout(&context->bus->i2c, (uint16_t)interger);
+			bcm283x_i2c_release(context->bus);
+			return 0;
+
+		case BCM283X_I2C_GET_BUS_RATE: /* Retrieve the SCL rate achieved with the current core clock */
+			clk_hz = READ_ONCE(i2c_bcm283x_clk_hz);
+			interger = clk_hz / bcm283x_i2c_divider(&context->config.speed, clk_hz);
+			res = rtdm_safe_copy_to_user(fd, arg, &interger, sizeof(int));
+			if (res) {
+				printk(KERN_ERR "%s: Can't copy bus rate from driver to user space (%d)!\r\n", __FUNCTION__, res);
+				return (res < 0) ? res : -res;
+			}
+			return 0;
+
+		case BCM283X_I2C_GET_SCHED_STATS: /* Retrieve the lateness of the transactions */
+			rtdm_lock_get_irqsave(&context->sched.lock, lock_ctx);
+			sched = context->sched.stats;
+			rtdm_lock_put_irqrestore(&context->sched.lock, lock_ctx);
+			res = rtdm_safe_copy_to_user(fd, arg, &sched, sizeof(sched));
+			if (res) {
+				printk(KERN_ERR "%s: Can't copy statistics from driver to user space (%d)!\r\n", __FUNCTION__, res);
+				return (res < 0) ? res : -res;
+			}
+			return 0;
+
+		case BCM283X_I2C_RING_WAKEUP: /* Wake up the ring poller */
+			if (!context->ring)
+				return -ENODEV;
+			rtdm_event_signal(&context->ring->wakeup);
+			return 0;
+
 		default: /* Unexpected case */
 			printk(KERN_ERR "%s: Unexpected request : %d!\r\n", __FUNCTION__, request);
 			return -EINVAL;
@@ -511,19 +4100,128 @@ static int bcm283x_i2c_rtdm_ioctl_rt(struct rtdm_fd *fd, unsigned int request, v
 
 }
 
+/**
+ * Whether an IOCTL request uses the staging buffers, the configuration or the register cache of the device instance, and must
+ * not run concurrently with the other such requests on the same file descriptor.
+ * @param request Request number as passed by the user.
+ * @return 1 if the request is serialized under the data lock of the instance, 0 otherwise.
+ */
+static int bcm283x_i2c_ioctl_serialized(unsigned int request) {
+
+	switch (request) {
+
+		case BCM283X_I2C_SET_SLAVE_ADDRESS:
+		case BCM283X_I2C_SET_SLAVE_REGISTER_ADDRESS:
+		case BCM283X_I2C_SET_BAUDRATE:
+		case BCM283X_I2C_SET_BUS_SPEED:
+		case BCM283X_I2C_SET_CLOCK_DIVIDER:
+		case BCM283X_I2C_SET_CMDS:
+		case BCM283X_I2C_SET_CMDS_SIZE:
+		case BCM283X_I2C_SET_FLAGS:
+		case BCM283X_I2C_SET_TRANSFER_BUDGET:
+		case BCM283X_I2C_SET_RETRY:
+		case BCM283X_I2C_GET_BUS_RATE:
+		case BCM283X_I2C_TRANSFER:
+		case BCM283X_I2C_SMBUS:
+		case BCM283X_I2C_READ_TS:
+		case BCM283X_I2C_REGMAP_SETUP:
+		case BCM283X_I2C_REGMAP_READ:
+		case BCM283X_I2C_REGMAP_WRITE:
+		case BCM283X_I2C_REGMAP_SYNC:
+		case BCM283X_I2C_REGMAP_DROP:
+			return 1;
+
+		default: /* Bus-wide state, the sampler, the deadlines or the CRC, protected on their own */
+			return 0;
+
+	}
+
+}
+
+/**
+ * IOCTL handler. Requests on the data of the instance run one at a time, as RTDM doesn't serialize the system
+ * calls on a file descriptor shared by several threads.
+ * @param[in] fd File descriptor.
+ * @param[in] request Request number as passed by the user.
+ * @param[in,out] arg Request argument as passed by the user.
+ * @return A positive value or 0 on success. On failure return either -ENOSYS, to request that the function be called again from the opposite realtime/non-realtime context, or another negative error code.
+ */
+static int bcm283x_i2c_rtdm_ioctl_rt(struct rtdm_fd *fd, unsigned int request, void __user *arg) {
+
+	i2c_bcm283x_context_t *context;
+	int res;
+
+	if (!bcm283x_i2c_ioctl_serialized(request))
+		return bcm283x_i2c_ioctl(fd, request, arg);
+
+	/* Retrieve context */
+	context = (i2c_bcm283x_context_t *) rtdm_fd_to_private(fd);
+
+	res = rtdm_mutex_lock(&context->data_lock);
+	if (res)
+		return res;
+	res = bcm283x_i2c_ioctl(fd, request, arg);
+	rtdm_mutex_unlock(&context->data_lock);
+
+	return res;
+
+}
+
+/**
+ * IOCTL handler for the requests that must run in secondary mode. The other requests are
+ * sent back to the real-time handler.
+ * @param[in] fd File descriptor.
+ * @param[in] request Request number as passed by the user.
+ * @param[in,out] arg Request argument as passed by the user.
+ * @return 0 on success. On failure return either -ENOSYS, to request that the function be called again from the opposite realtime/non-realtime context, or another negative error code.
+ */
+static int bcm283x_i2c_rtdm_ioctl_nrt(struct rtdm_fd *fd, unsigned int request, void __user *arg) {
+
+	i2c_bcm283x_context_t *context;
+
+	/* Retrieve context */
+	context = (i2c_bcm283x_context_t *) rtdm_fd_to_private(fd);
+
+	/* Analyze request */
+	switch (request) {
+
+		case BCM283X_I2C_RING_SETUP: /* Set up the rings */
+			return bcm283x_i2c_ring_setup(fd, context, arg);
+
+		case BCM283X_I2C_POOL_SETUP: /* Register the buffer pool */
+			return bcm283x_i2c_pool_setup(fd, context, arg);
+
+		case BCM283X_I2C_SAMPLER_START: /* Start the periodic sampler */
+			return bcm283x_i2c_sampler_start(fd, context, arg);
+
+		case BCM283X_I2C_SAMPLER_STOP: /* Stop the periodic sampler */
+			return bcm283x_i2c_sampler_stop(context);
+
+		case BCM283X_I2C_SET_DRDY: /* Change the data-ready line of the sampler */
+			return bcm283x_i2c_set_drdy(fd, context, arg);
+
+		default: /* Real-time request */
+			return -ENOSYS;
+
+	}
+
+}
+
 /**
  * This structure describes the RTDM driver.
  */
 static struct rtdm_driver i2c_bcm283x_driver = {
 	.profile_info = RTDM_PROFILE_INFO(foo, RTDM_CLASS_EXPERIMENTAL, RTDM_SUBCLASS_GENERIC, 42),
-	.device_flags = RTDM_NAMED_DEVICE | RTDM_EXCLUSIVE | RTDM_FIXED_MINOR,
-	.device_count = 1,
+	.device_flags = RTDM_NAMED_DEVICE | RTDM_FIXED_MINOR,
+	.device_count = BCM283X_I2C_BUS_COUNT,
 	.context_size = sizeof(struct i2c_bcm283x_context_s),
 	.ops = {
 		.open = bcm283x_i2c_rtdm_open,
 		.read_rt = bcm283x_i2c_rtdm_read_rt,
 		.write_rt = bcm283x_i2c_rtdm_write_rt,
 		.ioctl_rt = bcm283x_i2c_rtdm_ioctl_rt,
+		.ioctl_nrt = bcm283x_i2c_rtdm_ioctl_nrt,
+		.mmap = bcm283x_i2c_rtdm_mmap,
 		.close = bcm283x_i2c_rtdm_close
 	}
 };
@@ -553,12 +4251,20 @@ static int __init bcm283x_i2c_rtdm_init(void) {
 		return -1;
 	}
 
-	/* Configure the i2c port from bcm2835 library with arbitrary settings */
-	bcm2835_i2c_begin();
-	bcm2835_i2c_setClockDivider(BCM2835_I2C_CLOCK_DIVIDER_626);
+	/* Find the rate the clock dividers apply to */
+	bcm283x_i2c_clk_init();
+
+	/* Start correlating the System Timer with the real-time clock */
+	rtdm_lock_init(&i2c_bcm283x_clock_map.lock);
+	bcm283x_i2c_clock_sync();
 
-	/* Prepare to register the device */
-	for(device_id = 0; device_id < 1; device_id++){
+	/* Configure the i2c ports and prepare the interrupt-driven transfer engine of each */
+	i2c_bcm283x_bus_count = bsc0 ? 2 : 1;
+	for (device_id = 0; device_id < i2c_bcm283x_bus_count; device_id++)
+		bcm283x_i2c_bus_init(&i2c_bcm283x_buses[device_id], i2c_bcm283x_bsc[device_id]);
+
+	/* Prepare to register the devices */
+	for(device_id = 0; device_id < i2c_bcm283x_bus_count; device_id++){
 
 		/* Set device parameters */
 		i2c_bcm283x_devices[device_id].driver = &i2c_bcm283x_driver;
@@ -588,6 +4294,11 @@ static int __init bcm283x_i2c_rtdm_init(void) {
 					printk(KERN_ERR "Unknown error code returned.\r\n");
 					break;
 			}
+			while (--device_id >= 0)
+				rtdm_dev_unregister(&i2c_bcm283x_devices[device_id]);
+			for (device_id = 0; device_id < i2c_bcm283x_bus_count; device_id++)
+				bcm283x_i2c_bus_cleanup(&i2c_bcm283x_buses[device_id]);
+			bcm283x_i2c_clk_cleanup();
 			return res;
 		}
 	}
@@ -612,14 +4323,17 @@ static void __exit bcm283x_i2c_rtdm_exit(void) {
 		return;
 	}
 
-	/* Unregister the two devices */
-	for (device_id = 0; device_id < 1; device_id++) {
+	/* Unregister the devices */
+	for (device_id = 0; device_id < i2c_bcm283x_bus_count; device_id++) {
 		printk(KERN_INFO "%s: Unregistering device %d ...\r\n", __FUNCTION__, device_id);
 		rtdm_dev_unregister(&i2c_bcm283x_devices[device_id]);
 	}
 
-	/* Release the i2c pins */
-	bcm2835_i2c_end();
+	/* Stop the transfer engines and release the i2c pins */
+	for (device_id = 0; device_id < i2c_bcm283x_bus_count; device_id++)
+		bcm283x_i2c_bus_cleanup(&i2c_bcm283x_buses[device_id]);
+
+	bcm283x_i2c_clk_cleanup();
 
 	/* Unmap memory */
 	bcm2835_close();